@@ -0,0 +1,164 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chess.h"
+
+#define BLOCK 4096  // Positions read before the workers start on them
+#define LINE 512    // Longest EPD line kept; longer ones are cut short
+#define OUT 64      // Longest result
+
+typedef enum _Mode {COUNT, CLASSIFY, SEARCH} Mode;
+
+typedef struct _Slot {      // One input line and its result
+    char line[LINE];
+    char out[OUT];
+} Slot;
+
+typedef struct _Worker {
+    pthread_t thread;
+    Game *game;
+} Worker;
+
+static Slot block[BLOCK];
+static int lines;           // Slots filled in the current block
+static volatile int claimed;    // Next slot for a worker to take
+static Mode mode = COUNT;
+static Limits limits = {1, 0, 0, NULL, 1, NULL};
+static Table table;
+
+void analyse(Slot *slot, Game *game) { /* Fill in the result for one line */
+    static char *reps = REPS;
+    Moves list;
+    Result result;
+    char check;
+    if(!loadFen(slot->line, game)) {
+        strcpy(slot->out, "error");
+        return;
+    }
+    switch(mode) {
+        case COUNT:
+            sprintf(slot->out, "%d", generateAll(game, &list));
+            break;
+        case CLASSIFY:
+            check = threatened(game->info.color, game->king[game->info.color], game);
+            if(!generateAll(game, &list)) {
+                strcpy(slot->out, check ? "mate" : "stalemate");
+            } else {
+                strcpy(slot->out, check ? "check" : "normal");
+            }
+            break;
+        case SEARCH:
+            result = search(game, limits);
+            if(!result.length) {
+                strcpy(slot->out, "none");
+                break;
+            }
+            sprintf(slot->out, "%c%d%c%d%.1s %d %d", 'a' + result.best.src.file, result.best.src.rank + 1,
+                    'a' + result.best.dst.file, result.best.dst.rank + 1, result.best.promo ? &reps[result.best.promo | 0x8] : "",
+                    result.score, result.depth);
+            break;
+    }
+}
+
+void *work(void *arg) { /* Take slots from the block until it runs out */
+    Worker *self = arg;
+    int n;
+    while((n = __sync_fetch_and_add(&claimed, 1)) < lines) {
+        analyse(block + n, self->game);
+    }
+    return NULL;
+}
+
+int run(FILE *in, int threads) { /* Stream in through the workers a block at a time, printing results in input order */
+    Worker *workers = calloc(threads, sizeof(Worker));
+    char *end;
+    int n;
+    if(!workers) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    for(n = 0; n < threads; ++n) {
+        workers[n].game = newGame();
+    }
+    do {
+        for(lines = 0; lines < BLOCK && fgets(block[lines].line, LINE, in); ) {
+            if((end = strpbrk(block[lines].line, "\r\n"))) {
+                *end = '\0';
+            } else if(!feof(in)) {
+                for(n = getc(in); n != '\n' && n != EOF; n = getc(in)); // Drop the rest of an overlong line
+            }
+            if(block[lines].line[0] && block[lines].line[0] != '#') {
+                ++lines;
+            }
+        }
+        claimed = 0;
+        for(n = 1; n < threads; ++n) {
+            pthread_create(&workers[n].thread, NULL, work, workers + n);
+        }
+        work(workers);
+        for(n = 1; n < threads; ++n) {
+            pthread_join(workers[n].thread, NULL);
+        }
+        for(n = 0; n < lines; ++n) {
+            printf("%s\t%s\n", block[n].out, block[n].line);
+        }
+    } while(lines == BLOCK);
+    for(n = 0; n < threads; ++n) {
+        free(workers[n].game);
+    }
+    free(workers);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, ret;
+    char bad = 0;
+    while(!bad && (opt = getopt(argc, argv, "m:d:j:t:")) != -1) {
+        switch(opt) {
+            case 'm':   // What to find out about each position
+                if(!strcmp(optarg, "count")) {
+                    mode = COUNT;
+                } else if(!strcmp(optarg, "classify")) {
+                    mode = CLASSIFY;
+                } else if(!strcmp(optarg, "search")) {
+                    mode = SEARCH;
+                } else {
+                    fprintf(stderr, "%s: unknown mode %s\n", argv[0], optarg);
+                    bad = 1;
+                }
+                break;
+            case 'd':   // Search depth
+                limits.depth = atoi(optarg) < 1 ? 1 : atoi(optarg) > MAXPLY ? MAXPLY : atoi(optarg);
+                break;
+            case 'j':   // Worker threads
+                threads = atoi(optarg);
+                break;
+            case 't':   // Transposition table shared by the searches, in megabytes
+                if(!newTable(atoi(optarg), &table)) {
+                    fprintf(stderr, "Couldn't allocate %s MB table\n", optarg);
+                    return 2;
+                }
+                limits.table = &table;
+                break;
+            default:    // getopt() has already named the bad option
+                bad = 1;
+        }
+    }
+    if(bad || optind + 1 < argc) {
+        fprintf(stderr, "usage: %s [-m count|classify|search] [-d depth] [-j threads] [-t MB] [file]\n", argv[0]);
+        return 2;
+    }
+    if(optind < argc && strcmp(argv[optind], "-") && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 2;
+    }
+    ret = run(in, threads > 0 ? threads : 1);
+    if(in != stdin) {
+        fclose(in);
+    }
+    return ret;
+}
@@ -0,0 +1,143 @@
+#include "chess.h"
+
+/* Precomputed tables {{{1 */
+static Bits knights[64];    // Knight attacks from each square
+static Bits kings[64];      // King attacks from each square
+static Bits pawns[2][64];   // Pawn captures from each square, by color
+static Bits rays[8][64];    // Open rays from each square: N, E, NE, NW, then S, W, SW, SE
+
+unsigned long long pieceKeys[16][64];  // Zobrist keys for each nybble value on each spot
+unsigned long long castleKeys[16];      // Zobrist keys for each set of castle flags
+unsigned long long sideKey;             // Zobrist key toggled when black is to move
+
+static char steps[8][2] = { {0, 1}, {1, 0}, {1, 1}, {-1, 1}, {0, -1}, {-1, 0}, {-1, -1}, {1, -1} };
+
+static Bits mask(char file, char rank) { /* Single bit for an on-board spot, 0 otherwise {{{2 */
+    if(file < 0 || file > 7 || rank < 0 || rank > 7) {
+        return 0;
+    }
+    return 1ULL << (rank << 3 | file);
+}
+
+static unsigned long long next(unsigned long long *seed) { /* xorshift64* step {{{2 */
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545F4914F6CDD1DULL;
+}
+
+void initBits() { /* Fill in the attack tables. Safe to call more than once {{{2 */
+    static char done = 0;
+    static char jumps[8][2] = { {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2} };
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    char sq, n, file, rank;
+    if(done) {
+        return;
+    }
+    for(n = 0; n < 16; ++n) {   // Fixed seed so keys match from run to run
+        for(sq = 0; sq < 64; ++sq) {
+            pieceKeys[n][sq] = n ? next(&seed) : 0;
+        }
+        castleKeys[n] = n ? next(&seed) : 0;
+    }
+    sideKey = next(&seed);
+    for(sq = 0; sq < 64; ++sq) {
+        file = sq & 7;
+        rank = sq >> 3;
+        knights[sq] = kings[sq] = 0;
+        for(n = 0; n < 8; ++n) {
+            knights[sq] |= mask(file + jumps[n][0], rank + jumps[n][1]);
+            kings[sq] |= mask(file + steps[n][0], rank + steps[n][1]);
+        }
+        pawns[0][sq] = mask(file - 1, rank + 1) | mask(file + 1, rank + 1);
+        pawns[1][sq] = mask(file - 1, rank - 1) | mask(file + 1, rank - 1);
+        for(n = 0; n < 8; ++n) {
+            rays[n][sq] = 0;
+            for(file = (sq & 7) + steps[n][0], rank = (sq >> 3) + steps[n][1]; mask(file, rank); file += steps[n][0], rank += steps[n][1]) {
+                rays[n][sq] |= mask(file, rank);
+            }
+        }
+    }
+    done = 1;
+}
+
+/* Attack generation {{{1 */
+static Bits slide(char first, char sq, Bits occ) { /* Attacks along four rays starting at first, stopping at blockers {{{2 */
+    Bits att = 0;
+    Bits block;
+    char n;
+    for(n = first; n < first + 2; ++n) {    // Rays heading up the board: nearest blocker is the lowest bit
+        att |= rays[n][sq];
+        if((block = rays[n][sq] & occ)) {
+            att ^= rays[n][LSB(block)];
+        }
+    }
+    for(n = first + 4; n < first + 6; ++n) {    // Rays heading down the board: nearest blocker is the highest bit
+        att |= rays[n][sq];
+        if((block = rays[n][sq] & occ)) {
+            att ^= rays[n][MSB(block)];
+        }
+    }
+    return att;
+}
+
+Bits attacks(char piece, char sq, Bits occ) { /* Spots a piece on sq attacks, given the occupied spots {{{2 */
+    switch(piece & 0x7) {
+        case PAWN:
+            return pawns[piece >> 3][sq];
+        case KNIGHT:
+            return knights[sq];
+        case KING:
+            return kings[sq];
+        case BISHOP:
+            return slide(2, sq, occ);
+        case ROOK:
+            return slide(0, sq, occ);
+        case QUEEN:
+            return slide(0, sq, occ) | slide(2, sq, occ);
+    }
+    return 0;
+}
+
+Bits between(char a, char b) { /* Spots strictly between a and b on a shared line, 0 if they don't share one {{{2 */
+    char n;
+    for(n = 0; n < 8; ++n) {
+        if(rays[n][a] & (1ULL << b)) {
+            return rays[n][a] & ~rays[n][b] & ~(1ULL << b);
+        }
+    }
+    return 0;
+}
+
+Bits line(char a, char b) { /* The whole line through a and b, 0 if they don't share one {{{2 */
+    char n;
+    for(n = 0; n < 8; ++n) {
+        if(rays[n][a] & (1ULL << b)) {
+            return rays[n][a] | rays[n ^ 4][a] | (1ULL << a);   // Opposite rays are four apart
+        }
+    }
+    return 0;
+}
+
+Bits beyond(char a, char b, Bits occ) { /* Spots past b on the ray from a through b, up to the first blocker {{{2 */
+    Bits block;
+    char n;
+    for(n = 0; n < 8; ++n) {
+        if(rays[n][a] & (1ULL << b)) {
+            if(!(block = rays[n][b] & occ)) {
+                return rays[n][b];
+            }
+            return rays[n][b] ^ rays[n][n < 4 ? LSB(block) : MSB(block)];   // Rays up the board meet the lowest bit first
+        }
+    }
+    return 0;
+}
+
+Bits attackers(char color, char sq, Bits occ, Game *game) { /* Pieces of color attacking sq, given the occupied spots {{{2 */
+    char c = color << 3;
+    return (pawns[!color][sq] & game->bits[PAWN | c])
+        | (knights[sq] & game->bits[KNIGHT | c])
+        | (kings[sq] & game->bits[KING | c])
+        | (slide(2, sq, occ) & (game->bits[BISHOP | c] | game->bits[QUEEN | c]))
+        | (slide(0, sq, occ) & (game->bits[ROOK | c] | game->bits[QUEEN | c]));
+}
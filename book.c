@@ -0,0 +1,112 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chess.h"
+
+static const BookEntry *find(Book *book, unsigned long long key);
+
+/* Book files {{{1 */
+char openBook(const char *path, Book *book) { /* Map a book file read only. Returns 0 if it can't be used {{{2 */
+    const DbHeader *header;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+    if(fstat(fd, &st) || st.st_size < sizeof(DbHeader)) {
+        close(fd);
+        return 0;
+    }
+    book->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping keeps the file open
+    if(book->map == MAP_FAILED) {
+        return 0;
+    }
+    book->length = st.st_size;
+    header = book->map;
+    if(memcmp(header->magic, BOOKMAGIC, sizeof(BOOKMAGIC)) || header->version != BOOKVERSION || header->size != sizeof(BookEntry)) {
+        munmap(book->map, book->length);
+        return 0;
+    }
+    madvise(book->map, book->length, MADV_RANDOM);  // Lookups jump around
+    book->entry = (const BookEntry *)(header + 1);
+    book->count = (book->length - sizeof(DbHeader)) / sizeof(BookEntry);
+    return 1;
+}
+
+void closeBook(Book *book) { /* Unmap a book file {{{2 */
+    munmap(book->map, book->length);
+    book->map = NULL;
+    book->entry = NULL;
+    book->count = 0;
+}
+
+/* Lookup {{{1 */
+static const BookEntry *find(Book *book, unsigned long long key) { /* First entry for key, or NULL {{{2 */
+    const BookEntry *entry = book->entry;
+    unsigned long long lo = 0, hi = book->count, mid;
+    char guesses = 0;
+    while(lo < hi) {    // Everything before lo is below key, everything from hi on is at least key
+        if(hi - lo > 16 && guesses++ < 8 && key >= entry[lo].key && key <= entry[hi - 1].key && entry[hi - 1].key > entry[lo].key) {
+            mid = lo + (unsigned long long)((double)(key - entry[lo].key) / (entry[hi - 1].key - entry[lo].key) * (hi - 1 - lo));
+        } else {
+            mid = lo + (hi - lo) / 2;   // Keys are hashes, so guessing rarely misses; bisect if it keeps doing so
+        }
+        if(entry[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < book->count && entry[lo].key == key ? entry + lo : NULL;
+}
+
+int bookMoves(Book *book, Game *game, Moves *list, unsigned int *weights) { /* Fill list with the book's legal moves here and weights with their weights {{{2 */
+    const BookEntry *entry = find(book, game->key);
+    Moves moves;
+    Move move;
+    int n, m;
+    list->count = 0;
+    for(; entry && entry < book->entry + book->count && entry->key == game->key && list->count < MAXMOVES; ++entry) {
+        move = unpackMove(entry->move, game);
+        for(m = 0; m < list->count; ++m) {  // A damaged or hand-built book can list a move twice; keep the first
+            if(SQ(list->move[m].src) == SQ(move.src) && SQ(list->move[m].dst) == SQ(move.dst) && list->move[m].promo == move.promo) {
+                break;
+            }
+        }
+        if(m < list->count) {
+            continue;
+        }
+        possible(move.src, game, &moves);
+        for(n = 0; n < moves.count; ++n) {  // A key collision can name a move that isn't legal here
+            if(SQ(moves.move[n].dst) == SQ(move.dst) && moves.move[n].promo == move.promo) {
+                weights[list->count] = entry->weight;
+                list->move[list->count++] = moves.move[n];
+                break;
+            }
+        }
+    }
+    return list->count;
+}
+
+char bookMove(Book *book, Game *game, Move *move) { /* Pick a book move at random by weight. Returns 0 if the book doesn't know the position {{{2 */
+    unsigned int weights[MAXMOVES];
+    unsigned long long total = 0, pick;
+    Moves list;
+    int n;
+    if(!bookMoves(book, game, &list, weights)) {
+        return 0;
+    }
+    for(n = 0; n < list.count; ++n) {
+        total += weights[n];
+    }
+    pick = ((unsigned long long)rand() << 31 ^ rand()) % (total ? total : 1);
+    for(n = 0; n < list.count - 1 && pick >= weights[n]; ++n) {
+        pick -= weights[n];
+    }
+    *move = list.move[n];
+    return 1;
+}
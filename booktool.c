@@ -0,0 +1,188 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chess.h"
+
+#define START "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+static BookEntry *entries;
+static unsigned long long count, room;
+static int plies = 20;      // Moves into each game worth remembering
+
+void collect(Game *game, Move *move, void *arg) { /* replayPgn() callback adding each early move to the book */
+    int *ply = arg;
+    if(!move || (*ply)++ >= plies) {
+        return;
+    }
+    if(count == room) {
+        room = room ? room * 2 : 1 << 16;
+        if(!(entries = realloc(entries, room * sizeof(BookEntry)))) {
+            fprintf(stderr, "Out of memory for book entries\n");
+            exit(2);
+        }
+    }
+    entries[count].key = game->key;
+    entries[count].weight = 1;
+    entries[count].move = packMove(*move);
+    entries[count].spare = 0;
+    ++count;
+}
+
+int compare(const void *a, const void *b) { /* Order entries by key, then move */
+    const BookEntry *x = a, *y = b;
+    if(x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (int)x->move - (int)y->move;
+}
+
+int readPgn(const char *path, Game *game) { /* Add the opening moves of every game in a PGN file. Returns the games with errors */
+    const char *text, *next, *end;
+    struct stat st;
+    Replay replay;
+    unsigned long long before;
+    int fd = open(path, O_RDONLY);
+    int bad = 0, ply;
+    void *map;
+    if(fd < 0 || fstat(fd, &st)) {
+        perror(path);
+        return -1;
+    }
+    if(!st.st_size) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    end = (const char *)map + st.st_size;
+    for(text = map; text < end; text = next) {
+        if(!(next = nextPgn(text, end))) {
+            next = end;
+        }
+        before = count;
+        ply = 0;
+        if(replayPgn(text, next, game, collect, &ply, &replay) < 0) {
+            count = before; // Don't learn from a game that goes wrong
+            ++bad;
+        }
+    }
+    munmap(map, st.st_size);
+    return bad;
+}
+
+int build(const char *output, char **paths, int files, unsigned int least) { /* Merge the moves from every file into a sorted book */
+    Game *game = newGame();
+    DbHeader header;
+    unsigned long long n, kept = 0;
+    FILE *out;
+    int bad, errors = 0;
+    for(; files; --files, ++paths) {
+        if((bad = readPgn(*paths, game)) < 0) {
+            free(game);
+            return 2;
+        }
+        errors += bad;
+    }
+    free(game);
+    qsort(entries, count, sizeof(BookEntry), compare);
+    for(n = 0; n < count; ++n) {    // Sum repeats of the same move, dropping rare ones
+        if(kept && entries[kept - 1].key == entries[n].key && entries[kept - 1].move == entries[n].move) {
+            entries[kept - 1].weight += entries[kept - 1].weight < 0xFFFFFFFF;
+        } else if(!kept || entries[kept - 1].weight >= least) {
+            entries[kept++] = entries[n];
+        } else {
+            entries[kept - 1] = entries[n];
+        }
+    }
+    if(kept && entries[kept - 1].weight < least) {
+        --kept;
+    }
+    if(!(out = fopen(output, "wb"))) {
+        perror(output);
+        return 2;
+    }
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, BOOKMAGIC);
+    header.version = BOOKVERSION;
+    header.size = sizeof(BookEntry);
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(entries, sizeof(BookEntry), kept, out);
+    if(fclose(out)) {
+        perror(output);
+        return 2;
+    }
+    fprintf(stderr, "%llu moves seen, %llu book entries, %d games skipped for errors\n", count, kept, errors);
+    free(entries);
+    return 0;
+}
+
+int list(const char *path, const char *fen) { /* Print the book's moves for a position */
+    static char *reps = REPS;
+    unsigned int weights[MAXMOVES];
+    Game *game = newGame();
+    Book book;
+    Moves moves;
+    int n;
+    if(!openBook(path, &book)) {
+        fprintf(stderr, "%s: not a version %d book\n", path, BOOKVERSION);
+        free(game);
+        return 2;
+    }
+    if(!loadFen(fen, game)) {
+        fprintf(stderr, "Bad FEN: %s\n", fen);
+        closeBook(&book);
+        free(game);
+        return 2;
+    }
+    bookMoves(&book, game, &moves, weights);
+    for(n = 0; n < moves.count; ++n) {
+        printf("%c%c%d%c%d%.1s %u\n", reps[moves.move[n].piece & 0x7], 'a' + moves.move[n].src.file, moves.move[n].src.rank + 1,
+                'a' + moves.move[n].dst.file, moves.move[n].dst.rank + 1, moves.move[n].promo ? &reps[moves.move[n].promo | 0x8] : "",
+                weights[n]);
+    }
+    closeBook(&book);
+    free(game);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *output = NULL, *lookup = NULL;
+    unsigned int least = 1;
+    int opt;
+    char bad = 0;
+    while(!bad && (opt = getopt(argc, argv, "o:p:m:l:")) != -1) {
+        switch(opt) {
+            case 'o':   // Build this book from the PGN files
+                output = optarg;
+                break;
+            case 'p':   // Plies into each game to remember
+                plies = atoi(optarg);
+                break;
+            case 'm':   // Fewest times a move must be played to stay in the book
+                least = atoi(optarg);
+                break;
+            case 'l':   // List this book's moves for a position
+                lookup = optarg;
+                break;
+            default:    // getopt() has already named the bad option
+                bad = 1;
+        }
+    }
+    if(bad || !output == !lookup || (output && optind == argc) || (lookup && optind + 1 < argc)) {
+        fprintf(stderr, "usage: %s -o book.bin [-p plies] [-m min] games.pgn...\n       %s -l book.bin [fen]\n", argv[0], argv[0]);
+        return 2;
+    }
+    if(lookup) {
+        return list(lookup, optind < argc ? argv[optind] : START);
+    }
+    return build(output, argv + optind, argc - optind, least);
+}
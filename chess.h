@@ -8,8 +8,25 @@
 #define CHECK   2
 #define STALE   3
 #define MATE    4
+#define TIE     5     // Draw by the fifty-move rule, threefold repetition or too little material
+
+#define STACK   256  // Moves that can be taken back with unmakeMove()
+#define MAXMOVES 256 // More than any position has legal moves
+#define MAXPLY  64   // Deepest line a search follows
+#define WIN     32000 // Score for mate at the root; mates further away score less
+#define MATES   512  // Scores this close to WIN are mates, whether searched or from the endgame tables
+#define BUCKET  4    // Transposition table entries per bucket, the last one always replaced
+#define DEPTH(data) ((data) & 0xFF) // Transposition table data keeps the depth in its low byte
+
+#define LIGHT   0x55AA55AA55AA55AAULL   // Light spots; a1 is dark
+
+#define SQ(spot) ((spot).rank << 3 | (spot).file)
+#define POS(sq) ((Pos){(sq) & 0x7, (sq) >> 3})
+#define LSB(bits) __builtin_ctzll(bits)
+#define MSB(bits) (63 - __builtin_clzll(bits))
 
 typedef int Row;
+typedef unsigned long long Bits;
 
 typedef enum _Type {EMPTY, PAWN, KNIGHT, KING, ENP, BISHOP, ROOK, QUEEN} Type;
 typedef enum _Color {WHITE = 0x0, BLACK = 0x8} Color;
@@ -26,30 +43,226 @@ typedef struct _Move {
         capture:4;
     Pos src;
     Pos dst;
-    struct _Move *next;
+    unsigned char promo;    // Type a pawn reaching the last rank becomes, EMPTY for every other move
 } Move;
 
+typedef unsigned short Code;    // A move in 16 bits: source spot << 6 | destination spot, promotion type << 12, 1 << 15 for a capture
+
+typedef struct _Moves { // Caller-provided move buffer
+    int count;
+    Move move[MAXMOVES];
+} Moves;
+
+typedef struct _Info {
+    unsigned short \
+        castle:4, \
+        bcap:3, \
+        wcap:3, \
+        brow:1, \
+        wrow:1, \
+        color:1, \
+        stale:1, \
+        check:1, \
+        mate:1;
+} Info;
+
+typedef struct _Undo {  // Everything makeMove() changes that the move itself can't recreate
+    unsigned long long key;
+    Move move;
+    Info info;
+    Pos king;
+    signed char passant;    // Spot of the en passant marker cleared by the move, -1 if none
+    unsigned char noCap;
+} Undo;
+
+typedef struct _Entry {
+    unsigned long long key;     // Position key xor data, so a half-written entry never matches
+    unsigned long long data;    // Zero for an empty entry
+} Entry;
+
+typedef struct _Table {
+    Entry *slot;
+    unsigned long long mask;    // Buckets - 1; nothing here changes during a search, so threads only share the entries
+} Table;
+
+/* Opening book file, in host byte order: a DbHeader with magic "CHESSBK", version BOOKVERSION and
+ * record size 16, then BookEntry records sorted by key and then move, at most one per key and move. */
+#define BOOKMAGIC "CHESSBK"
+#define BOOKVERSION 2 // 2: moves carry their promotion piece; version 1 books left it out
+#define BOOK "book.bin" // Opening book the frontends use when it's there
+
+typedef struct _BookEntry {
+    unsigned long long key;     // Zobrist key of the position
+    unsigned int weight;        // Times the move was played
+    Code move;                  // Readers only go by its spots and promotion
+    unsigned short spare;
+} BookEntry;
+
+typedef struct _Book {      // A mapped book file
+    const BookEntry *entry;
+    unsigned long long count;
+    void *map;
+    unsigned long long length;
+} Book;
+
+typedef struct _Limits {    // When search() should stop; zero means no limit
+    int depth;
+    unsigned int time;  // Milliseconds
+    unsigned long long nodes;
+    Table *table;       // Transposition table to use, or NULL
+    int threads;        // Threads searching together; 0 or 1 for one
+    Book *book;         // Play from this opening book while it knows the position, or NULL
+} Limits;
+
+typedef struct _Result {
+    Move best;
+    int score;          // Centipawns for the side to move, or WIN less the plies to mate
+    int depth;          // Deepest iteration completed
+    unsigned long long nodes;   // Summed over all threads
+    unsigned long long qnodes;  // Of those, the ones in quiescence search
+    unsigned long long cutoffs, firsts; // Beta cutoffs, and those the first move tried caused, summed likewise
+    unsigned long long hits, misses, stores, collisions;    // Transposition table use, summed likewise
+    unsigned int time;  // Milliseconds
+    int length;         // Zero only when there is no legal move, and then best is all zeros
+    Move pv[MAXPLY];    // Principal variation, starting with best
+} Result;
+
+/* Position database file, all in host byte order (little endian on the usual machines):
+ *   header  8 bytes  magic "CHESSDB\0"
+ *           4 bytes  version, DBVERSION
+ *           4 bytes  record size, sizeof(Record) = 36
+ *   records, back to back until the end of the file:
+ *           32 bytes board: eight 32-bit rows, rank 1 first, one nybble per spot with the a file lowest,
+ *                    holding REPS indices; an en passant marker (ENP) sits on the skipped spot
+ *           1 byte   flags: castle rights in bits 0-3 (white Q, white K, black Q, black K), black to move in bit 4
+ *           2 bytes  white then black king spot, rank * 8 + file
+ *           1 byte   half moves since the last capture or pawn move */
+#define DBMAGIC "CHESSDB"
+#define DBVERSION 1
+
+typedef struct _Record {
+    Row board[8];
+    unsigned char flags;
+    unsigned char king[2];
+    unsigned char noCap;
+} Record;
+
+typedef struct _Position {  // A position in 32 bytes, for when a whole Game is too much to keep
+    Bits occ;                   // Spots holding real pieces
+    unsigned char piece[16];    // Their nybble values from the lowest spot up, two a byte, the first in the low nybble
+    unsigned char flags;        // As in Record
+    signed char passant;        // Spot of the en passant marker, -1 if none
+    unsigned char noCap;
+} Position;
+
+typedef struct _DbHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int size;
+} DbHeader;
+
+/* Endgame table files, one per material signature and named for it (KQKR.tb: white king and queen against
+ * black king and rook; the side with more is always white). A DbHeader with magic "CHESSTB", version TBVERSION
+ * and record size 1, then one signed byte per index: 0 for a draw or an impossible position, v > 0 when the
+ * side to move mates in v plies, v < 0 when it is mated in -v - 1 plies. The index is, most significant first,
+ * the side to move, the white king folded onto a1-d4 (a1-d8 with pawns) by mirroring, then the black king
+ * and the other pieces in signature order, six bits a spot. Castling and en passant are left out. */
+#define TBMAGIC "CHESSTB"
+#define TBVERSION 1
+#define TBMEN 4         // Most pieces, kings included, a table covers
+#define TBDIR "tb"      // Endgame tables the frontends use when they're there
+
+typedef struct _TbStats {   // What building a table found, over its legal positions
+    unsigned long long wins, draws, losses;
+    int longest;        // Plies in the longest mate
+} TbStats;
+
+typedef struct _Replay {    // How far replayPgn() got through a game
+    int plies;          // Moves played
+    const char *error;  // NULL, or why the game stopped early
+    char san[16];       // Last move read
+} Replay;
+
+typedef struct _Database {  // A mapped database file; records point straight into the mapping
+    const Record *record;
+    unsigned long long count;
+    void *map;
+    unsigned long long length;
+} Database;
+
 typedef struct _Game {
-    struct {
-        unsigned short \
-            castle:4, \
-            bcap:3, \
-            wcap:3, \
-            brow:1, \
-            wrow:1, \
-            color:1, \
-            stale:1, \
-            check:1, \
-            mate:1;
-    } info;
+    unsigned long long key; // Zobrist key of the position, kept by set(), unset(), fixCastle() and makeMove()
+    Info info;
+    unsigned char noCap;    // Plies since the last capture or pawn move, for the fifty-move rule and repetitions()
     Pos king[2];
     Row capture[2][2];
     Row board[8];
-    char (*fp)();
+    Bits bits[16];  // One mask per nybble value, kept in sync by set() and unset()
+    Bits occ[2];    // Spots holding real pieces (not en passant markers), by color
+    Bits from[64];  // Spots attacked by the piece on each spot
+    unsigned char seen[2][64];  // Number of pieces of each color attacking each spot
+    int psqt;       // Material plus piece-square score from pst[], both phases packed, kept by set() and unset()
+    Undo undo[STACK];   // Most recent moves and the keys before them, for unmakeMove() and repetitions()
+    unsigned int ply;
 } Game;
 
 extern Game *newGame();
-extern Move *possible(Pos spot, Game *game);
+extern const char *loadFen(const char *fen, Game *game);
+extern void makeMove(Move move, Game *game);
+extern void unmakeMove(Game *game);
+extern char execMove(Move move, Game *game);
+extern void copyGame(Game *new, Game *old);
+extern int possible(Pos spot, Game *game, Moves *list);
+extern int generateAll(Game *game, Moves *list);
 extern char value(Pos spot, Game *game);
+extern char threatened(char color, Pos spot, Game *game);
+extern int repetitions(Game *game);
+extern void packRecord(Game *game, Record *record);
+extern void unpackRecord(const Record *record, Game *game);
+extern void packPosition(Game *game, Position *position);
+extern void unpackPosition(const Position *position, Game *game);
+extern Code packMove(Move move);
+extern Move unpackMove(Code code, Game *game);
+
+extern char openDatabase(const char *path, Database *db);
+extern void closeDatabase(Database *db);
+extern void newHeader(DbHeader *header);
+
+extern char openBook(const char *path, Book *book);
+extern void closeBook(Book *book);
+extern int bookMoves(Book *book, Game *game, Moves *list, unsigned int *weights);
+extern char bookMove(Book *book, Game *game, Move *move);
+
+extern int openTablebases(const char *dir);
+extern char probeTablebase(Game *game, int *score);
+extern const char *buildTablebase(const char *dir, const char *name, int threads, TbStats *stats);
+
+extern char sanMove(const char *san, int length, Game *game, Move *move);
+extern const char *nextPgn(const char *text, const char *end);
+extern int replayPgn(const char *text, const char *end, Game *game, void (*seen)(Game *, Move *, void *), void *arg, Replay *replay);
+
+extern char newTable(unsigned int mb, Table *table);
+extern void clearTable(Table *table);
+extern void freeTable(Table *table);
+extern char probe(unsigned long long key, Table *table, unsigned long long *data);
+extern char store(unsigned long long key, unsigned long long data, Table *table);
+
+extern Result search(Game *game, Limits limits);
+
+extern int pst[16][64];
+
+extern void initEval();
+extern int evaluate(Game *game);
+
+extern unsigned long long pieceKeys[16][64];
+extern unsigned long long castleKeys[16];
+extern unsigned long long sideKey;
+
+extern void initBits();
+extern Bits attacks(char piece, char sq, Bits occ);
+extern Bits attackers(char color, char sq, Bits occ, Game *game);
+extern Bits between(char a, char b);
+extern Bits line(char a, char b);
+extern Bits beyond(char a, char b, Bits occ);
 
 #endif /* !_CHESS_H */
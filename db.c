@@ -0,0 +1,49 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chess.h"
+
+/* Database files {{{1 */
+void newHeader(DbHeader *header) { /* Fill in the header for a new database file {{{2 */
+    memset(header, 0, sizeof(DbHeader));
+    strcpy(header->magic, DBMAGIC);
+    header->version = DBVERSION;
+    header->size = sizeof(Record);
+}
+
+char openDatabase(const char *path, Database *db) { /* Map a database file read only. Returns 0 if it can't be used {{{2 */
+    const DbHeader *header;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+    if(fstat(fd, &st) || st.st_size < sizeof(DbHeader)) {
+        close(fd);
+        return 0;
+    }
+    db->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping keeps the file open
+    if(db->map == MAP_FAILED) {
+        return 0;
+    }
+    db->length = st.st_size;
+    header = db->map;
+    if(memcmp(header->magic, DBMAGIC, sizeof(DBMAGIC)) || header->version != DBVERSION || header->size != sizeof(Record)) {
+        munmap(db->map, db->length);
+        return 0;
+    }
+    madvise(db->map, db->length, MADV_SEQUENTIAL);  // Readers mostly walk straight through
+    db->record = (const Record *)(header + 1);
+    db->count = (db->length - sizeof(DbHeader)) / sizeof(Record);
+    return 1;
+}
+
+void closeDatabase(Database *db) { /* Unmap a database file {{{2 */
+    munmap(db->map, db->length);
+    db->map = NULL;
+    db->record = NULL;
+    db->count = 0;
+}
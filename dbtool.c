@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chess.h"
+
+#define LINE 512
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void recordFen(const Record *record, char *fen) { /* Write a record as FEN straight from its fields */
+    static char *reps = REPS;
+    static char *flags = "KQkq";
+    static char bits[4] = {1, 0, 3, 2};
+    char passant[3] = "-";
+    char piece, rank, file, blank, n;
+    for(rank = 7; rank >= 0; --rank) {
+        for(file = blank = 0; file < 8; ++file) {
+            piece = record->board[rank] >> (file << 2) & 0xF;
+            if((piece & 0x7) == ENP) {
+                passant[0] = 'a' + file;
+                passant[1] = '1' + rank;
+            }
+            if(piece & 0x3) {
+                if(blank) {
+                    *fen++ = '0' + blank;
+                    blank = 0;
+                }
+                *fen++ = reps[piece];
+            } else {
+                ++blank;
+            }
+        }
+        if(blank) {
+            *fen++ = '0' + blank;
+        }
+        *fen++ = rank ? '/' : ' ';
+    }
+    *fen++ = record->flags & 0x10 ? 'b' : 'w';
+    *fen++ = ' ';
+    for(n = 0; n < 4; ++n) {
+        if(record->flags & 0x1 << bits[n]) {
+            *fen++ = flags[n];
+        }
+    }
+    if(!(record->flags & 0xF)) {
+        *fen++ = '-';
+    }
+    sprintf(fen, " %s %d 1", passant, record->noCap);
+}
+
+int convert(FILE *in, const char *path) { /* Append a record for each FEN/EPD line of in to a new file at path */
+    Game *game = newGame();
+    FILE *out = fopen(path, "wb");
+    DbHeader header;
+    Record record;
+    char line[LINE];
+    unsigned long long count = 0, bad = 0;
+    double start = now();
+    if(!out) {
+        perror(path);
+        free(game);
+        return 2;
+    }
+    newHeader(&header);
+    fwrite(&header, sizeof(header), 1, out);
+    while(fgets(line, LINE, in)) {
+        if(!line[strspn(line, " \t\r\n")] || line[0] == '#') {
+            continue;
+        }
+        if(!loadFen(line, game)) {
+            ++bad;
+            continue;
+        }
+        packRecord(game, &record);
+        fwrite(&record, sizeof(record), 1, out);
+        ++count;
+    }
+    if(fclose(out)) {
+        perror(path);
+        free(game);
+        return 2;
+    }
+    fprintf(stderr, "%llu records written, %llu lines skipped, %.3fs\n", count, bad, now() - start);
+    free(game);
+    return 0;
+}
+
+int dump(const char *path, char stats) { /* Print every record as FEN, or just totals */
+    Database db;
+    const Record *record;
+    unsigned long long black = 0, castle = 0;
+    double start = now();
+    char fen[LINE];
+    if(!openDatabase(path, &db)) {
+        fprintf(stderr, "%s: not a version %d position database\n", path, DBVERSION);
+        return 2;
+    }
+    for(record = db.record; record < db.record + db.count; ++record) {
+        if(stats) {
+            black += record->flags >> 4 & 0x1;
+            castle += (record->flags & 0xF) != 0;
+        } else {
+            recordFen(record, fen);
+            puts(fen);
+        }
+    }
+    if(stats) {
+        printf("%llu records, %llu black to move, %llu with castle rights, %.3fs\n", db.count, black, castle, now() - start);
+    }
+    closeDatabase(&db);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    char *output = NULL;
+    char mode = 0;
+    int opt, ret;
+    char bad = 0;
+    while(!bad && (opt = getopt(argc, argv, "o:fs")) != -1) {
+        switch(opt) {
+            case 'o':   // Convert FEN/EPD lines into this file
+                output = optarg;
+                break;
+            case 'f':   // Print a database as FEN
+            case 's':   // Print a database's totals
+                mode = opt;
+                break;
+            default:    // getopt() has already named the bad option
+                bad = 1;
+        }
+    }
+    if(bad || !output == !mode || (mode && optind + 1 != argc) || optind + 1 < argc) {
+        fprintf(stderr, "usage: %s -o out.db [positions.fen]\n       %s -f|-s in.db\n", argv[0], argv[0]);
+        return 2;
+    }
+    if(mode) {
+        return dump(argv[optind], mode == 's');
+    }
+    if(optind < argc && strcmp(argv[optind], "-") && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 2;
+    }
+    ret = convert(in, output);
+    if(in != stdin) {
+        fclose(in);
+    }
+    return ret;
+}
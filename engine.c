@@ -1,12 +1,15 @@
 #include <stdlib.h>
+#include <string.h>
 #include "chess.h"
 #include "engine.h"
 
 #define color(val) (val >> 3)
 
 /* Game functions {{{1 */
-Game *newGame(char (*getfunc)(Move)) { /* Create a clean game {{{2 */
+Game *newGame() { /* Create a clean game {{{2 */
     Game *new = malloc(sizeof(Game));
+    initBits();
+    initEval();
     new->board[0] = 0x62537526;
     new->board[1] = 0x11111111;
     new->board[2] = 0x00000000;
@@ -25,10 +28,15 @@ Game *newGame(char (*getfunc)(Move)) { /* Create a clean game {{{2 */
     new->info.wcap = 0;
     new->info.bcap = 0;
     new->info.color = 0;
+    new->info.stale = 0;
+    new->info.check = 0;
+    new->info.mate = 0;
     new->noCap = 0;
+    new->ply = 0;
     new->king[0] = (Pos){4,0};
     new->king[1] = (Pos){4,7};
-    new->fp = getfunc;
+    syncBits(new);
+    new->key ^= castleKeys[new->info.castle];
     return new;
 }
 
@@ -42,11 +50,265 @@ void copyGame(Game *new, Game *game) { /* Copy the values of one game pointer to
     new->capture[1][0] = game->capture[1][0];
     new->capture[1][1] = game->capture[1][1];
     new->info = game->info;
+    new->key = game->key;
     new->king[0] = game->king[0];
     new->king[1] = game->king[1];
+    new->noCap = game->noCap;
+    new->psqt = game->psqt;
+    new->ply = game->ply;
+    for(n = 0; n < STACK; ++n) {
+        new->undo[n] = game->undo[n];
+    }
+    for(n = 0; n < 16; ++n) {
+        new->bits[n] = game->bits[n];
+    }
+    new->occ[0] = game->occ[0];
+    new->occ[1] = game->occ[1];
+    for(n = 0; n < 64; ++n) {
+        new->from[n] = game->from[n];
+        new->seen[0][n] = game->seen[0][n];
+        new->seen[1][n] = game->seen[1][n];
+    }
+}
+
+const char *loadFen(const char *fen, Game *game) { /* Set up a game from a FEN string. Returns the end of the parsed fields {{{2 */
+    static char *reps = REPS;
+    static Pos rooks[4] = {(Pos){0, 0}, (Pos){7, 0}, (Pos){0, 7}, (Pos){7, 7}};
+    static char *flags = "QKqk";
+    Pos spot;
+    char *piece;
+    char n;
+    int file = 0, rank = 7; // Plain ints, so overflowing a rank can't wrap around in a Pos
+    for(n = 0; n < 8; ++n) {
+        game->board[n] = 0x00000000;
+    }
+    game->king[0] = game->king[1] = (Pos){0, 0};
+    syncBits(game);
+    game->capture[0][0] = 0x00000000;
+    game->capture[0][1] = 0x00000000;
+    game->capture[1][0] = 0x00000000;
+    game->capture[1][1] = 0x00000000;
+    game->info.castle = 0;
+    game->info.wrow = 0;
+    game->info.brow = 0;
+    game->info.wcap = 0;
+    game->info.bcap = 0;
+    game->info.stale = 0;
+    game->info.check = 0;
+    game->info.mate = 0;
+    game->noCap = 0;
+    game->ply = 0;
+    for(; *fen == ' '; ++fen);
+    for(; *fen && *fen != ' '; ++fen) {    // Piece placement, rank 8 first
+        if(*fen == '/') {
+            if(file != 8 || !rank--) {
+                return NULL;    // Fail unless the rank was exactly full and another one is left
+            }
+            file = 0;
+        } else if(*fen >= '1' && *fen <= '8') {
+            if((file += *fen - '0') > 8) {
+                return NULL;    // Fail if the rank overflows
+            }
+        } else if((piece = strchr(reps, *fen)) && (piece - reps) & 0x3) {
+            if(file > 7) {
+                return NULL;    // Fail if the rank overflows
+            }
+            spot = (Pos){file++, rank};
+            set(spot, piece - reps, game);
+            if(((piece - reps) & 0x7) == KING) {
+                game->king[color(piece - reps)] = spot;
+            }
+        } else {
+            return NULL;    // Fail on anything that isn't a piece
+        }
+    }
+    if(file != 8 || rank) {
+        return NULL;    // Fail unless all eight ranks were there
+    }
+    if(__builtin_popcountll(game->bits[KING]) != 1 || __builtin_popcountll(game->bits[KING | BLACK]) != 1) {
+        return NULL;    // Fail without exactly one king a side
+    }
+    if((game->bits[PAWN] | game->bits[PAWN | BLACK]) & 0xFF000000000000FFULL) {
+        return NULL;    // Fail with a pawn on the first or last rank
+    }
+    for(; *fen == ' '; ++fen);
+    if(*fen != 'w' && *fen != 'b') {
+        return NULL;    // Fail without a side to move
+    }
+    game->info.color = (*fen++ == 'b');
+    if(threatened(!game->info.color, game->king[!game->info.color], game)) {
+        return NULL;    // Fail if the side that just moved left its king in check
+    }
+    game->key ^= game->info.color ? sideKey : 0;
+    for(; *fen == ' '; ++fen);
+    for(; *fen && *fen != ' '; ++fen) {    // Castling rights, only kept if the rook is actually home
+        if((piece = strchr(flags, *fen)) && value(rooks[piece - flags], game) == (ROOK | ((piece - flags) & 0x2) << 2)) {
+            game->info.castle |= 0x1 << (piece - flags);
+        }
+    }
+    game->key ^= castleKeys[game->info.castle];
+    for(; *fen == ' '; ++fen);
+    if(*fen >= 'a' && *fen <= 'h') {   // En passant square becomes a marker of the side that just moved
+        if(fen[1] != (game->info.color ? '3' : '6') || value((Pos){fen[0] - 'a', fen[1] - '1'}, game)) {
+            return NULL;    // Fail unless it's the empty spot behind a pawn that just stepped twice
+        }
+        spot = (Pos){fen[0] - 'a', fen[1] - '1'};
+        set(spot, ENP | ((!game->info.color) << 3), game);
+        fen += 2;
+    } else if(*fen == '-') {
+        ++fen;
+    }
+    for(; *fen == ' '; ++fen);
+    if(*fen >= '0' && *fen <= '9') {
+        game->noCap = strtol(fen, (char **)&fen, 10);
+        strtol(fen, (char **)&fen, 10);    // Skip the fullmove number
+    }
+    game->info.check = threatened(game->info.color, game->king[game->info.color], game);
+    return fen;
+}
+
+void packRecord(Game *game, Record *record) { /* Write a game's position as a database record {{{2 */
+    char n;
+    for(n = 0; n < 8; ++n) {
+        record->board[n] = game->board[n];
+    }
+    record->flags = game->info.castle | game->info.color << 4;
+    record->king[0] = SQ(game->king[0]);
+    record->king[1] = SQ(game->king[1]);
+    record->noCap = game->noCap;
+}
+
+void unpackRecord(const Record *record, Game *game) { /* Set up a game from a database record {{{2 */
+    char n;
+    for(n = 0; n < 8; ++n) {
+        game->board[n] = record->board[n];
+    }
+    game->capture[0][0] = 0x00000000;
+    game->capture[0][1] = 0x00000000;
+    game->capture[1][0] = 0x00000000;
+    game->capture[1][1] = 0x00000000;
+    game->info.castle = record->flags & 0xF;
+    game->info.wrow = 0;
+    game->info.brow = 0;
+    game->info.wcap = 0;
+    game->info.bcap = 0;
+    game->info.color = record->flags >> 4 & 0x1;
+    game->info.stale = 0;
+    game->info.mate = 0;
+    game->noCap = record->noCap;
+    game->ply = 0;
+    game->king[0] = POS(record->king[0]);
+    game->king[1] = POS(record->king[1]);
+    syncBits(game);
+    game->key ^= castleKeys[game->info.castle] ^ (game->info.color ? sideKey : 0);
+    game->info.check = threatened(game->info.color, game->king[game->info.color], game);
+}
+
+void packPosition(Game *game, Position *position) { /* Squeeze a game's position into 32 bytes {{{2 */
+    Bits occ = game->occ[0] | game->occ[1];
+    Bits markers = game->bits[ENP] | game->bits[ENP | BLACK];
+    char n;
+    memset(position, 0, sizeof(Position));
+    position->occ = occ;
+    for(n = 0; occ; occ &= occ - 1, ++n) {
+        position->piece[n >> 1] |= value(POS(LSB(occ)), game) << ((n & 1) << 2);
+    }
+    position->flags = game->info.castle | game->info.color << 4;
+    position->passant = markers ? LSB(markers) : -1;
+    position->noCap = game->noCap;
+}
+
+void unpackPosition(const Position *position, Game *game) { /* Set up a game from a packed position {{{2 */
+    Record record;
+    Bits occ = position->occ;
+    unsigned char piece;
+    char n;
+    memset(&record, 0, sizeof(Record));
+    for(n = 0; occ; occ &= occ - 1, ++n) {
+        piece = position->piece[n >> 1] >> ((n & 1) << 2) & 0xF;
+        record.board[LSB(occ) >> 3] |= (Row)piece << ((LSB(occ) & 0x7) << 2);
+        if((piece & 0x7) == KING) {
+            record.king[piece >> 3] = LSB(occ);
+        }
+    }
+    if(position->passant >= 0) {    // The marker belongs to the side that just moved
+        record.board[position->passant >> 3] |= (Row)(ENP | (~position->flags >> 1 & 0x8)) << ((position->passant & 0x7) << 2);
+    }
+    record.flags = position->flags;
+    record.noCap = position->noCap;
+    unpackRecord(&record, game);
+}
+
+Code packMove(Move move) { /* Squeeze a move into 16 bits {{{2 */
+    char takes = (move.capture & 0x3) || ((move.capture & 0x7) == ENP && (move.piece & 0x7) == PAWN);
+    return SQ(move.src) << 6 | SQ(move.dst) | move.promo << 12 | takes << 15;
+}
+
+Move unpackMove(Code code, Game *game) { /* The move a code stands for in this game, which it must come from {{{2 */
+    Move move;
+    move.src = POS(code >> 6 & 0x3F);
+    move.dst = POS(code & 0x3F);
+    move.piece = value(move.src, game);
+    move.capture = value(move.dst, game);
+    move.promo = code >> 12 & 0x7;
+    return move;
 }
 
 /* Helpers {{{1 */
+static void syncBits(Game *game) { /* Rebuild the piece masks and attack maps from the rows {{{2 */
+    Row rows[8];
+    Pos spot;
+    char n;
+    for(n = 0; n < 8; ++n) {
+        rows[n] = game->board[n];
+        game->board[n] = 0x00000000;
+    }
+    for(n = 0; n < 16; ++n) {
+        game->bits[n] = 0;
+    }
+    game->occ[0] = game->occ[1] = 0;
+    game->key = 0;
+    game->psqt = 0;
+    for(n = 0; n < 64; ++n) {
+        game->from[n] = 0;
+        game->seen[0][n] = game->seen[1][n] = 0;
+    }
+    for(spot.rank = 7; spot.rank >= 0; --spot.rank) {
+        for(spot.file = 7; spot.file >= 0; --spot.file) {
+            n = (rows[spot.rank] >> (spot.file << 2)) & 0xF;
+            if(n) {
+                set(spot, n, game); // Put each piece back so everything else follows along
+            }
+        }
+    }
+}
+
+static void account(char sq, char color, Bits att, Game *game) { /* Record that the piece on sq now attacks att {{{2 */
+    Bits gain = att & ~game->from[sq];
+    Bits loss = game->from[sq] & ~att;
+    game->from[sq] = att;
+    for(; gain; gain &= gain - 1) {
+        ++game->seen[color][LSB(gain)];
+    }
+    for(; loss; loss &= loss - 1) {
+        --game->seen[color][LSB(loss)];
+    }
+}
+
+static void relink(char sq, Game *game) { /* Stretch or cut the rays of the sliders that run into sq {{{2 */
+    Bits occ = game->occ[0] | game->occ[1];
+    Bits straight = game->bits[ROOK] | game->bits[QUEEN] | game->bits[ROOK | BLACK] | game->bits[QUEEN | BLACK];
+    Bits diagonal = game->bits[BISHOP] | game->bits[QUEEN] | game->bits[BISHOP | BLACK] | game->bits[QUEEN | BLACK];
+    Bits sliders = (attacks(ROOK, sq, occ) & straight) | (attacks(BISHOP, sq, occ) & diagonal);
+    Bits past;
+    char s;
+    for(; sliders; sliders &= sliders - 1) {
+        s = LSB(sliders);
+        past = beyond(s, sq, occ);  // Only this stretch of the slider's attacks changes
+        account(s, color(value(POS(s), game)), occ & (1ULL << sq) ? game->from[s] & ~past : game->from[s] | past, game);
+    }
+}
+
 char inline value(Pos spot, Game *game) { /* Get value of nybble at spot {{{2 */
     return (game->board[spot.rank] >> (spot.file << 2)) & 0xF;
 }
@@ -56,30 +318,58 @@ char inline capval(char color, char row, char spot, Game *game) { /* Get value o
 }
 
 void inline unset(Pos spot, Game *game) { /* Unset nybble at spot {{{2 */
+    Bits bit = 1ULL << SQ(spot);
+    char piece = value(spot, game);
+    if(piece & 0x3) {
+        account(SQ(spot), color(piece), 0, game);  // Piece no longer attacks anything
+    }
+    game->bits[piece] &= ~bit;  // Keep masks in step with the rows
+    game->key ^= pieceKeys[piece][SQ(spot)];
+    game->psqt -= pst[piece][SQ(spot)];
+    game->occ[0] &= ~bit;
+    game->occ[1] &= ~bit;
     game->board[spot.rank] &= ~(0xF << (spot.file << 2));
+    if(piece & 0x3) {
+        relink(SQ(spot), game); // Sliders blocked here now see further
+    }
 }
 
 void inline set(Pos spot, char piece, Game *game) { /* Set nybble at spot to piece {{{2 */
+    Bits bit = 1ULL << SQ(spot);
+    if(piece & 0x3) {
+        game->occ[color(piece)] |= bit;    // En passant markers don't block anything
+    }
+    game->bits[piece] |= bit;
+    game->key ^= pieceKeys[piece][SQ(spot)];
+    game->psqt += pst[piece][SQ(spot)];
     game->board[spot.rank] |= (piece << (spot.file << 2));
+    if(piece & 0x3) {
+        relink(SQ(spot), game); // Sliders passing through here are now blocked
+        account(SQ(spot), color(piece), attacks(piece, SQ(spot), game->occ[0] | game->occ[1]), game);
+    }
 }
 
 Pos inline movediff(Move move) { /* Return the distances travelled in a Pos {{{2 */
     return (Pos){move.dst.file - move.src.file, move.dst.rank - move.src.rank};
 }
 
-static void enp(Game *game) { /* Clean up any old en passant markers {{{2 */
+static char enp(Game *game) { /* Clean up any old en passant markers, returning where one was {{{2 */
     Pos spot = (Pos){7, game->info.color ? 2 : 5};  // Set appropriate rank
+    char found = -1;
     for(; spot.file >= 0; --spot.file) {            // Iterate through spots in rank
         if((value(spot, game) & 0x7) == ENP) {
             unset(spot, game);                      // Unset if en passant marker
+            found = SQ(spot);
         }
     }
+    return found;
 }
 
 /* Castling {{{1 */
 static void fixCastle(Move move, Game *game) { /* Fix up the castling flag nybble as needed {{{2 */
     static Pos rooks[2][2] = { {(Pos){0, 0}, (Pos){7, 0} }, {(Pos){0, 7}, (Pos){7, 7} } };
     char c = color(move.piece);
+    game->key ^= castleKeys[game->info.castle]; // Swap the old flags out of the key
     if((move.piece & 0x7) == ROOK) {    // If rook, unset bit based on src location
         if((move.src.file == rooks[c][0].file) && (move.src.rank == rooks[c][0].rank)) {
             game->info.castle &= ~(0x1 << (2*c));
@@ -91,15 +381,27 @@ static void fixCastle(Move move, Game *game) { /* Fix up the castling flag nybbl
     if((move.piece & 0x7) == KING) {    // If king, unset bits based on color
         game->info.castle &= ~(0x3 << 2*c);
     }
+    if((move.capture & 0x7) == ROOK) {  // If a rook was captured at home, its side loses that castle
+        c = color(move.capture);
+        if((move.dst.file == rooks[c][0].file) && (move.dst.rank == rooks[c][0].rank)) {
+            game->info.castle &= ~(0x1 << (2*c));
+        }
+        if((move.dst.file == rooks[c][1].file) && (move.dst.rank == rooks[c][1].rank)) {
+            game->info.castle &= ~(0x1 << (2*c+1));
+        }
+    }
+    game->key ^= castleKeys[game->info.castle];
 }
 
-static char castle(Move move, Game *game) { /* Deal with castling {{{2 */
-    static Pos rooks[2][2] = { {(Pos){0, 0}, (Pos){7, 0} }, {(Pos){0, 7}, (Pos){7, 7} } }; // Rook starting positions
+static char castling(Move move, Game *game) { /* May this king move castle? Returns 1 for Q-side, 2 for K-side, 0 if not {{{2 */
     static Pos empty[2] = {(Pos){1, 0}, (Pos){1, 7}};                                   // Empty squares for Q-side
     static Pos kdst[2][2] = { {(Pos){2, 0}, (Pos){6, 0} }, {(Pos){2, 7}, (Pos){6, 7} } };  // Destinations for kings
     static Pos rdst[2][2] = { {(Pos){3, 0}, (Pos){5, 0} }, {(Pos){3, 7}, (Pos){5, 7} } };  // Destinations for rooks
     char i;
     char c = color(move.piece);
+    if((move.src.file != 4) || (move.src.rank != kdst[c][0].rank)) {
+        return 0;   // Fail if the king isn't home
+    }
     if((move.dst.file == kdst[c][0].file) && move.dst.rank == kdst[c][0].rank) {
         if(value(kdst[c][0], game) || value(rdst[c][0], game) || value(empty[c], game)) {
             return 0;   // Fail if spots aren't empty
@@ -119,70 +421,61 @@ static char castle(Move move, Game *game) { /* Deal with castling {{{2 */
     if(threatened(c, game->king[c], game) || threatened(c, kdst[c][i], game) || threatened(c, rdst[c][i], game)) {
         return 0;   // Fail if starting in, passing through, or ending in check
     }
-    Move rook = (Move){ROOK, EMPTY, rooks[c][i], rdst[c][i]};
-    doMove(rook, game); // Move rook to its destination
-    return 1;   // Send success so king will move
+    return i + 1;
+}
+
+static Move castle(Move move) { /* The rook move that goes with a castling king move {{{2 */
+    static Pos rooks[2][2] = { {(Pos){0, 0}, (Pos){7, 0} }, {(Pos){0, 7}, (Pos){7, 7} } }; // Rook starting positions
+    static Pos rdst[2][2] = { {(Pos){3, 0}, (Pos){5, 0} }, {(Pos){3, 7}, (Pos){5, 7} } };  // Destinations for rooks
+    char i = move.dst.file > move.src.file;
+    char c = color(move.piece);
+    return (Move){ROOK | (c << 3), EMPTY, rooks[c][i], rdst[c][i]};
 }
 
 /* Game end determinants {{{1 */
-static char material(Game *game) { /* Is checkmate still viable? {{{2 */
-    Pos iter;
-    struct {
-        char val:4, \
-            wmin:2, \
-            bmin:2;
-    } i;
-    i.wmin = 0;
-    i.bmin = 0;
-    for(iter.rank = 7; iter.rank >= 0; --iter.rank) {
-        for(iter.file = 7; iter.file >= 0; --iter.file) {
-            i.val = value(iter, game);
-            switch(i.val & 0x7) {
-                case PAWN:
-                case ROOK:
-                case QUEEN:
-                    return 0;
-                case KNIGHT:
-                case BISHOP:
-                    if(color(i.val)) {
-                        ++i.bmin;
-                    } else {
-                        ++i.wmin;
-                    }
-            }
-        }
+static char material(Game *game) { /* Is mate out of reach for both sides? {{{2 */
+    Bits minors = game->bits[KNIGHT] | game->bits[KNIGHT | BLACK] | game->bits[BISHOP] | game->bits[BISHOP | BLACK];
+    if(game->bits[PAWN] | game->bits[PAWN | BLACK] | game->bits[ROOK] | game->bits[ROOK | BLACK]
+            | game->bits[QUEEN] | game->bits[QUEEN | BLACK]) {
+        return 0;
+    }
+    if(!(minors & (minors - 1))) {
+        return 1;   // A lone knight or bishop can't mate
     }
-    return (i.bmin > 1) || (i.wmin > 1);
+    return !(minors & ~(game->bits[BISHOP] | game->bits[BISHOP | BLACK]))
+        && (!(minors & LIGHT) || !(minors & ~LIGHT));  // Nor can bishops that all stay on one color
 }
 
-char threatened(char color, Pos spot, Game *game) { /* Check if spot is threatened, assuming it matches color {{{2 */
-    Pos iter;
-    Move move;
-    move.dst = spot;
-    move.capture = value(spot, game);
-    for(iter.rank = 7; iter.rank >= 0; --iter.rank) {
-        for(iter.file = 7; iter.file >= 0; --iter.file) {   // Iterate through spots on board
-            move.src = iter;
-            move.piece = value(iter, game);
-            if((color != color(move.piece)) && valid(move, game)) {
-                return 1;   // Return 1 if opposing piece can legally move to spot
-            }
-        }
+int repetitions(Game *game) { /* Times the position occurred before, back to the last capture or pawn move {{{2 */
+    int n, count = 0;
+    int back = game->noCap < game->ply ? game->noCap : game->ply;   // Plies the undo ring remembers keys for
+    if(back > STACK) {
+        back = STACK;
+    }
+    for(n = 4; n <= back; n += 2) { // Same side to move, and it takes two moves each to come back
+        count += game->undo[(game->ply - n) % STACK].key == game->key;
     }
-    return 0;   // Return 0 if no pieces can legally move to spot
+    return count;
+}
+
+char threatened(char color, Pos spot, Game *game) { /* Check if spot is threatened, assuming it matches color {{{2 */
+    return game->seen[!color][SQ(spot)] != 0;   // Any opposing piece attacking spot
 }
 
 static char mate(char color, Game *game) { /* Check for {check,stale}mate {{{2 */
-    Move *moves;
-    Pos iter;
-    for(iter.rank = 7; iter.rank >= 0; --iter.rank) {
-        for(iter.file = 7; iter.file >= 0; --iter.file) {
-            if(color(value(iter, game)) == color) { // Make sure we're only looking at threatened color
-                moves = possible(iter, game);
-                if(moves->next) {   // If moves are available, moves->next will be non-NULL
-                    return 0;   // If anyone can move, it's not mate
-                }
-            }
+    Pos king = game->king[color];
+    Bits pieces;
+    Legal legal;
+    constrain(color, game, &legal);
+    if(generate(king, game, &legal, NULL)) {
+        return 0;   // The king is the likeliest piece to have a way out, and the only one that can answer a double check
+    }
+    if(legal.checks > 1) {
+        return 1;
+    }
+    for(pieces = game->occ[color] & ~(1ULL << SQ(king)); pieces; pieces &= pieces - 1) {
+        if(generate(POS(LSB(pieces)), game, &legal, NULL)) {
+            return 0;   // If anyone can move, it's not mate
         }
     }
     return 1; // If no one could move, it was mate
@@ -198,22 +491,14 @@ static char pawn(Move move, Game *game) { /* Pawn movement {{{2 */
     Pos temp;
     char dir = (color(move.piece) ? -1 : 1);    // Proper direction of motion based on color
     if(move.capture) {  // Pawn captures need special logic
-        if((diff.file*diff.file == 1) && (move.src.rank + dir == move.dst.rank)) {
-            if((move.capture & 0x7) == ENP) {
-                temp = (Pos){move.dst.file, move.src.rank};
-                unset(temp, game);  // Unset the pawn that matches the en passant marker
-            }
-            return 1;
-        }
-        return 0;
+        return (diff.file*diff.file == 1) && (move.src.rank + dir == move.dst.rank);
     }
     if(move.src.file != move.dst.file) {
         return 0;   // Fail if the pawn is trying to leave its file without a capture
     }
     temp = (Pos){move.src.file, (color(move.piece) ? 5 : 2)};
-    if((move.src.rank == (color(move.piece) ? 6 : 1)) && (diff.rank*diff.rank == 4) && !(value(temp, game))) {
-        set(temp, (ENP | (game->info.color << 3)), game);   // Leave an en passant marker
-        return 1;
+    if((move.src.rank == (color(move.piece) ? 6 : 1)) && (diff.rank == 2*dir) && !(value(temp, game))) {
+        return 1;   // Double step from the starting rank
     }
     return diff.rank == dir;
 }
@@ -225,11 +510,7 @@ static char knight(Move move, Game *game) { /* Knight movement {{{2 */
 
 static char king(Move move, Game *game) { /* King movement {{{2 */
     Pos diff = movediff(move);
-    if(diff.file*diff.file <= 1 && diff.rank*diff.rank <= 1 || castle(move, game)) {
-        game->king[color(move.piece)] = move.dst;   // Record new king location
-        return 1;
-    }
-    return 0;
+    return (diff.file*diff.file <= 1 && diff.rank*diff.rank <= 1) || castling(move, game);
 }
 
 static char bishop(Move move, Game *game) { /* Bishop movement {{{2 */
@@ -276,6 +557,112 @@ static char queen(Move move, Game *game) { /* Queen movement {{{2 */
     return (rook(move, game) || bishop(move, game));    // Queen moves either like a rook or bishop
 }
 
+static Bits reach(Pos spot, Game *game) { /* Spots the piece at spot could possibly move to {{{2 */
+    static Bits castles[2] = {0x44ULL, 0x44ULL << 56};  // King destinations when castling
+    char piece = value(spot, game);
+    char c = color(piece);
+    char sq = SQ(spot);
+    Bits occ = game->occ[0] | game->occ[1];
+    Bits push;
+    switch(piece & 0x7) {
+        case PAWN:  // Captures of pieces or markers, plus one or two steps forward onto empty spots
+            push = (c ? (1ULL << sq) >> 8 : (1ULL << sq) << 8) & ~occ;
+            if(push & (c ? 0xFF0000000000ULL : 0xFF0000ULL)) {
+                push |= (c ? push >> 8 : push << 8) & ~occ;
+            }
+            return push | (attacks(piece, sq, occ) & (game->occ[!c] | game->bits[ENP | (!c << 3)]));
+        case KING:  // Castling destinations are left to valid() to sort out
+            return (attacks(piece, sq, occ) | (game->info.castle & (0x3 << 2*c) ? castles[c] : 0)) & ~game->occ[c];
+    }
+    return attacks(piece, sq, occ) & ~game->occ[c];
+}
+
+/* Move generation {{{1 */
+static void constrain(char color, Game *game, Legal *legal) { /* Find the checks and pins on color's king {{{2 */
+    char sq = SQ(game->king[color]);
+    char c = !color << 3;
+    Bits occ = game->occ[0] | game->occ[1];
+    Bits checkers = attackers(!color, sq, occ, game);
+    Bits snipers = (attacks(ROOK, sq, 0) & (game->bits[ROOK | c] | game->bits[QUEEN | c]))
+        | (attacks(BISHOP, sq, 0) & (game->bits[BISHOP | c] | game->bits[QUEEN | c]));
+    Bits shield;
+    legal->pinned = 0;
+    for(; snipers; snipers &= snipers - 1) {
+        shield = between(sq, LSB(snipers)) & occ;
+        if(shield && !(shield & (shield - 1)) && (shield & game->occ[color])) {
+            legal->pinned |= shield;    // A lone own piece between king and slider
+        }
+    }
+    legal->checks = __builtin_popcountll(checkers);
+    legal->target = ~0ULL;
+    if(legal->checks == 1) {
+        legal->target = checkers | between(sq, LSB(checkers));  // Capture the checker or step in the way
+    } else if(legal->checks) {
+        legal->target = 0;  // Only the king can answer a double check
+    }
+}
+
+static char generate(Pos spot, Game *game, Legal *legal, Moves *list) { /* Append the legal moves of the piece at spot; without a list, stop at the first {{{2 */
+    static const char promotions[4] = {QUEEN, ROOK, BISHOP, KNIGHT};
+    Move move;
+    Bits targets, passant = 0;
+    char c, n;
+    move.src = spot;
+    move.piece = value(spot, game);
+    move.promo = EMPTY;
+    c = color(move.piece);
+    targets = reach(spot, game);
+    if((move.piece & 0x7) == PAWN) {
+        passant = targets & game->bits[ENP | (!c << 3)];    // Takes two pieces off the board at once, so left to safe()
+    }
+    if((move.piece & 0x7) != KING) {
+        targets &= legal->target;
+        if(legal->pinned & (1ULL << SQ(spot))) {
+            targets &= line(SQ(game->king[c]), SQ(spot));   // Stay on the pin ray
+        }
+        targets &= ~passant;
+    }
+    for(targets |= passant; targets; targets &= ~(1ULL << MSB(targets))) {
+        move.dst = POS(MSB(targets));
+        move.capture = value(move.dst, game);
+        if(((move.piece & 0x7) == KING) && ((move.dst.file - move.src.file) * (move.dst.file - move.src.file) == 4) && !castling(move, game)) {
+            continue;   // Castling is the only reachable move with conditions beyond the masks
+        }
+        if(((move.piece & 0x7) == KING || (passant & (1ULL << SQ(move.dst)))) && !safe(move, game)) {
+            continue;   // Every other move was already kept to the squares the checks and pins allow
+        }
+        if(!list) {
+            return 1;
+        }
+        if((move.piece & 0x7) != PAWN || (move.dst.rank != 0 && move.dst.rank != 7)) {
+            list->move[list->count++] = move;
+            continue;
+        }
+        for(n = 0; n < 4; ++n) {
+            move.promo = promotions[n];
+            list->move[list->count++] = move;   // One move for each piece the pawn can become
+        }
+        move.promo = EMPTY;
+    }
+    return 0;
+}
+
+static char safe(Move move, Game *game) { /* Does move leave its own king unthreatened? {{{2 */
+    char c = color(move.piece);
+    char passant = ((move.piece & 0x7) == PAWN) && ((move.capture & 0x7) == ENP);
+    Pos king = ((move.piece & 0x7) == KING) ? move.dst : game->king[c];
+    Bits gone = 1ULL << SQ(move.dst);   // Captured pieces stop attacking
+    Bits occ;
+    if(!game->seen[!c][SQ(game->king[c])] && (move.piece & 0x7) == KING) {
+        return !game->seen[!c][SQ(move.dst)];   // Without a check, no ray runs through the king and the attack maps are exact
+    }
+    if(passant) {
+        gone |= 1ULL << SQ(((Pos){move.dst.file, move.src.rank})); // So does a pawn taken en passant
+    }
+    occ = ((game->occ[0] | game->occ[1]) & ~gone & ~(1ULL << SQ(move.src))) | (1ULL << SQ(move.dst));
+    return !(attackers(!c, SQ(king), occ, game) & ~gone);
+}
+
 /* Movement execution logic {{{1 */
 static char valid(Move move, Game *game) { /* Is the move valid? {{{2 */
     static char (*moves[8])(Move move, Game *game) = {empty, pawn, knight, king, empty, bishop, rook, queen};
@@ -286,6 +673,10 @@ static char valid(Move move, Game *game) { /* Is the move valid? {{{2 */
     if(diff.rank == 0 & diff.file == 0) {
         return 0;   // Fail if trying to move to self
     }
+    if(((move.piece & 0x7) == PAWN && move.dst.rank == (color(move.piece) ? 0 : 7))
+            != (move.promo == KNIGHT || move.promo == BISHOP || move.promo == ROOK || move.promo == QUEEN)) {
+        return 0;   // Promotions must name their piece, and nothing else may
+    }
     if(move.capture && (color(move.capture) == color(move.piece))) {
         if(move.capture & 0x3) {
             return 0;   // Fail if trying to capture own piece
@@ -302,7 +693,7 @@ void doMove(Move move, Game *game) { /* Actually update the board. {{{2 */
     unset(move.src, game);
 }
 
-static Move promote(Move move, Game *game) { /* Promote a pawn. Calls game's callback function to determine piece {{{2 */
+static void promote(Move move, Game *game) { /* Promote a pawn to the piece the move names {{{2 */
     if((move.piece & 0x7) != PAWN) {
         return; // You can't promote a non-pawn
     }
@@ -310,12 +701,12 @@ static Move promote(Move move, Game *game) { /* Promote a pawn. Calls game's cal
         return; // Pawns only promote at the end
     }
     unset(move.src, game);
-    set(move.src, (move.piece & 0x8) | (game->fp(move) & 0x7), game);   // Use callback to determine new value
+    set(move.src, (move.piece & 0x8) | move.promo, game);
 }
 
 void capture(Move move, Game *game) { /* Properly execute a capture, relocating piece to capture zone {{{2 */
     if((move.capture & 0x7) == ENP) {   // Make en passant markers show up as pawns in capture zone
-        move.capture = ((move.piece & 0x7) == PAWN) ? PAWN | ((!game->info.color) << 3) : EMPTY;
+        move.capture = ((move.piece & 0x7) == PAWN) ? PAWN | (move.capture & 0x8) : EMPTY;
     }
     if(move.capture) {
         game->capture[game->info.color][game->info.color ? game->info.brow : game->info.wrow] |= (move.capture << ((game->info.color ? game->info.bcap : game->info.wcap) << 2));
@@ -331,84 +722,124 @@ void capture(Move move, Game *game) { /* Properly execute a capture, relocating
     }
 }
 
-char execMove(Move move, Game *game) { /* Actually execute a move! Lots of logic in here. {{{2 */
-    Game *save = malloc(sizeof(Game));
-    copyGame(save, game);   // Hold on to current board state if we need to bail
-    if(color(move.piece) ^ game->info.color) {
-        free(save);
-        return TURN;    // Fail if wrong color is trying to move
+void makeMove(Move move, Game *game) { /* Apply a move known to be valid, saving what unmakeMove() needs {{{2 */
+    Undo *undo = &game->undo[game->ply++ % STACK];
+    char c = color(move.piece);
+    undo->key = game->key;
+    undo->move = move;
+    undo->info = game->info;
+    undo->king = game->king[c];
+    undo->noCap = game->noCap;
+    undo->passant = enp(game);  // Remove old en passant markers
+    if((move.piece & 0x7) == PAWN) {
+        if((move.capture & 0x7) == ENP) {
+            unset((Pos){move.dst.file, move.src.rank}, game);   // Unset the pawn that matches the en passant marker
+        } else if((move.dst.rank - move.src.rank) * (move.dst.rank - move.src.rank) == 4) {
+            set((Pos){move.src.file, (move.src.rank + move.dst.rank) / 2}, ENP | (c << 3), game);  // Leave an en passant marker
+        }
+        promote(move, game);    // See if we're promoting a pawn
     }
-    if(!valid(move, game)) {
-        free(save);
-        return INVALID; // Fail if move is invalid
+    if((move.piece & 0x7) == KING) {
+        game->king[c] = move.dst;   // Record new king location
+        if((move.dst.file - move.src.file) * (move.dst.file - move.src.file) == 4) {
+            doMove(castle(move), game); // Move rook to its destination
+        }
     }
-    enp(game);  // Remove old en passant markers
-    promote(move, game);    // See if we're promoting a pawn
     doMove(move, game);     // Execute the move
-    if(threatened(game->info.color, game->king[game->info.color], game)) {
-        copyGame(game, save);
-        free(save);
-        return THREAT;  // Fail if own king will be threatened
-    }
-    if(!game->info.castle) {
+    if(game->info.castle) {
         fixCastle(move, game);  // Unset castling flags as needed
     }
     game->info.color = !game->info.color;   // Switch whose turn it is
+    game->key ^= sideKey;
     capture(move, game);    // Stick captured pieces in the capture zone
-    game->info.check = threatened(game->info.color, game->king[game->info.color], game);    // See if move caused check
-    game->info.mate = mate(game->info.color, game); // See if opponent is capable of moving
     if(move.capture || ((move.piece & 0x7) == PAWN)) {
         game->noCap = 0;
-    } else {
+    } else if(game->noCap < 255) {
         ++game->noCap;
     }
-    free(save);
+}
+
+void unmakeMove(Game *game) { /* Take back the last move made {{{2 */
+    Undo *undo = &game->undo[--game->ply % STACK];
+    Move move = undo->move;
+    Move rook;
+    char c = color(move.piece);
+    if((move.capture & 0x3) || (((move.capture & 0x7) == ENP) && ((move.piece & 0x7) == PAWN))) {    // Empty the capture zone spot it filled
+        game->capture[!c][c ? undo->info.wrow : undo->info.brow] &= ~(0xF << ((c ? undo->info.wcap : undo->info.bcap) << 2));
+    }
+    unset(move.dst, game);
+    set(move.src, move.piece, game);    // Put back the original piece, undoing any promotion
+    if(move.capture & 0x3) {
+        set(move.dst, move.capture, game);
+    }
+    if((move.piece & 0x7) == PAWN) {
+        if((move.capture & 0x7) == ENP) {
+            set((Pos){move.dst.file, move.src.rank}, PAWN | (move.capture & 0x8), game);    // Return the pawn taken en passant
+        } else if((move.dst.rank - move.src.rank) * (move.dst.rank - move.src.rank) == 4) {
+            unset((Pos){move.src.file, (move.src.rank + move.dst.rank) / 2}, game);
+        }
+    }
+    if(((move.piece & 0x7) == KING) && ((move.dst.file - move.src.file) * (move.dst.file - move.src.file) == 4)) {
+        rook = castle(move);
+        rook.src = rook.dst;
+        rook.dst = castle(move).src;
+        doMove(rook, game); // Return the rook to its corner
+    }
+    if(undo->passant >= 0) {
+        set(POS(undo->passant), ENP | (!c << 3), game); // Restore the marker enp() cleared
+    }
+    game->info = undo->info;
+    game->key = undo->key;
+    game->king[c] = undo->king;
+    game->noCap = undo->noCap;
+}
+
+char execMove(Move move, Game *game) { /* Actually execute a move! Lots of logic in here. {{{2 */
+    if(color(move.piece) ^ game->info.color) {
+        return TURN;    // Fail if wrong color is trying to move
+    }
+    if(!valid(move, game)) {
+        return INVALID; // Fail if move is invalid
+    }
+    makeMove(move, game);
+    if(threatened(!game->info.color, game->king[!game->info.color], game)) {
+        unmakeMove(game);
+        return THREAT;  // Fail if own king will be threatened
+    }
+    game->info.check = threatened(game->info.color, game->king[game->info.color], game);    // See if move caused check
+    game->info.mate = mate(game->info.color, game); // See if opponent is capable of moving
     if(game->info.check & game->info.mate) {
         return MATE;    // Return checkmate if opponent is in check and cannot move
     }
-    if(game->info.mate || material(game)) {
+    if(game->info.mate) {
         return STALE;   // Return stalemate if opponent cannot move but is not in check
     }
+    if(game->noCap >= 100 || repetitions(game) >= 2 || material(game)) {
+        return TIE;     // Fifty moves without a capture or pawn move, threefold repetition or no mating material
+    }
     if(game->info.check) {
         return CHECK;   // Return check if opponent is in check and can move
     }
-    if(game->noCap > 100) {
-        return TIE;
-    }
     return 1;   // Return 1 if nothing is special
 }
 
-Move *possible(Pos spot, Game *game) { /* Produce a list of valid moves. Terminates with one extra Move node {{{2 */
-    Game *test = malloc(sizeof(Game));
-    Move *list = malloc(sizeof(Move));
-    Move *curr = list;
-    Move move;
-    Pos iter;
-
-    list->next = NULL;
-    move.src = spot;
-    move.piece = value(spot, game);
-    if(color(move.piece) != game->info.color) {
-        return list;    // No reason to give valid moves for pieces that cannot move right now
-    }
-
-    for(iter.rank = 7; iter.rank >= 0; --iter.rank) {
-        for(iter.file = 7; iter.file >= 0; --iter.file) {
-            copyGame(test, game);   // Work in a disposable environment
-            move.dst = iter;
-            move.capture = value(iter, test);
-            if(valid(move, test)) {
-                doMove(move, test); // Actually make the move (in our disposable environment)
-                if(!threatened(test->info.color, test->king[test->info.color], test)) {
-                    *curr = move;   // If it's valid, stick it on the list
-                    curr->next = malloc(sizeof(Move));
-                    curr = curr->next;
-                }
-            }
-        }
-    }
-
-    free(test);
+int possible(Pos spot, Game *game, Moves *list) { /* Fill list with the valid moves of the piece at spot {{{2 */
+    Legal legal;
+    list->count = 0;
+    if(color(value(spot, game)) == game->info.color) {
+        constrain(game->info.color, game, &legal);
+        generate(spot, game, &legal, list); // No reason to give valid moves for pieces that cannot move right now
+    }
+    return list->count;
+}
 
-    return list;
+int generateAll(Game *game, Moves *list) { /* Fill list with every valid move for the side to move {{{2 */
+    Bits pieces;
+    Legal legal;
+    list->count = 0;
+    constrain(game->info.color, game, &legal);
+    for(pieces = game->occ[game->info.color]; pieces; pieces &= ~(1ULL << MSB(pieces))) {
+        generate(POS(MSB(pieces)), game, &legal, list);
+    }
+    return list->count;
 }
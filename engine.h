@@ -1,11 +1,20 @@
 #ifndef _ENGINE_H
 #define _ENGINE_H
+typedef struct _Legal {     // What the king's position allows the side to move, worked out once per generation
+    Bits target;    // Where other pieces must land: anywhere, on the checker or between it and the king, or nowhere
+    Bits pinned;    // Pieces shielding their king from an enemy slider
+    char checks;    // Pieces giving check
+} Legal;
+static void syncBits(Game *game);
+static void account(char sq, char color, Bits att, Game *game);
+static void relink(char sq, Game *game);
 char inline value(Pos spot, Game *game);
 char inline capval(char color, char row, char spot, Game *game);
 void inline unset(Pos spot, Game *game);
 void inline set(Pos spot, char piece, Game *game);
-static void enp(Game *game);
-static char castle(Move move, Game *game);
+static char enp(Game *game);
+static char castling(Move move, Game *game);
+static Move castle(Move move);
 static void fixCastle(Move move, Game *game);
 static char empty(Move move, Game *game);
 static char pawn(Move move, Game *game);
@@ -14,14 +23,28 @@ static char king(Move move, Game *game);
 static char bishop(Move move, Game *game);
 static char rook(Move move, Game *game);
 static char queen(Move move, Game *game);
-char valid(Move move, Game *game);
+static Bits reach(Pos spot, Game *game);
+static void constrain(char color, Game *game, Legal *legal);
+static char generate(Pos spot, Game *game, Legal *legal, Moves *list);
+static char safe(Move move, Game *game);
+static char valid(Move move, Game *game);
 void doMove(Move move, Game *game);
 char threatened(char color, Pos spot, Game *game);
 char check(Game *game);
 void copyMove(Move *new, Move old);
 void copyGame(Game *new, Game *old);
 void capture(Move move, Game *game);
+void makeMove(Move move, Game *game);
+void unmakeMove(Game *game);
 char execMove(Move move, Game *game);
-Move *possible(Pos spot, Game *game);
+int possible(Pos spot, Game *game, Moves *list);
+int generateAll(Game *game, Moves *list);
 Game *newGame();
+const char *loadFen(const char *fen, Game *game);
+void packRecord(Game *game, Record *record);
+void unpackRecord(const Record *record, Game *game);
+void packPosition(Game *game, Position *position);
+void unpackPosition(const Position *position, Game *game);
+Code packMove(Move move);
+Move unpackMove(Code code, Game *game);
 #endif /* !_ENGINE_H */
@@ -0,0 +1,174 @@
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "chess.h"
+
+#define S(mg, eg) ((int)((unsigned int)(mg) << 16) + (eg)) // Midgame and endgame scores packed so one add updates both
+#define MG(s) ((short)((unsigned int)((s) + 0x8000) >> 16))
+#define EG(s) ((short)(s))
+#define PHASE 24    // Phase with every minor, rook and queen still on the board
+
+/* Tables {{{1 */
+int pst[16][64];            // Material plus piece-square score for each nybble value on each spot, white positive
+static Bits files[8];
+
+static int worth[8] = {0, S(82, 94), S(337, 281), 0, 0, S(365, 297), S(477, 512), S(1025, 936)};
+static int mobility[8] = {0, 0, S(4, 4), 0, 0, S(5, 5), S(2, 4), S(1, 2)};  // Per attacked spot not held by a friend
+static int advance[8] = {0, S(5, 10), S(5, 15), S(10, 25), S(20, 45), S(35, 75), S(60, 120), 0};  // Passed pawn by ranks advanced
+static int doubled = S(-10, -20);
+static int isolated = S(-10, -15);
+
+static signed char squares[8][64] = {   // From white's side, rank 8 first; by Type, with the king's endgame table in the ENP slot
+    {0},
+    {  0,   0,   0,   0,   0,   0,   0,   0,
+      50,  50,  50,  50,  50,  50,  50,  50,
+      10,  10,  20,  30,  30,  20,  10,  10,
+       5,   5,  10,  25,  25,  10,   5,   5,
+       0,   0,   0,  20,  20,   0,   0,   0,
+       5,  -5, -10,   0,   0, -10,  -5,   5,
+       5,  10,  10, -20, -20,  10,  10,   5,
+       0,   0,   0,   0,   0,   0,   0,   0},
+    {-50, -40, -30, -30, -30, -30, -40, -50,
+     -40, -20,   0,   0,   0,   0, -20, -40,
+     -30,   0,  10,  15,  15,  10,   0, -30,
+     -30,   5,  15,  20,  20,  15,   5, -30,
+     -30,   0,  15,  20,  20,  15,   0, -30,
+     -30,   5,  10,  15,  15,  10,   5, -30,
+     -40, -20,   0,   5,   5,   0, -20, -40,
+     -50, -40, -30, -30, -30, -30, -40, -50},
+    {-30, -40, -40, -50, -50, -40, -40, -30,
+     -30, -40, -40, -50, -50, -40, -40, -30,
+     -30, -40, -40, -50, -50, -40, -40, -30,
+     -30, -40, -40, -50, -50, -40, -40, -30,
+     -20, -30, -30, -40, -40, -30, -30, -20,
+     -10, -20, -20, -20, -20, -20, -20, -10,
+      20,  20,   0,   0,   0,   0,  20,  20,
+      20,  30,  10,   0,   0,  10,  30,  20},
+    {-50, -40, -30, -20, -20, -30, -40, -50,
+     -30, -20, -10,   0,   0, -10, -20, -30,
+     -30, -10,  20,  30,  30,  20, -10, -30,
+     -30, -10,  30,  40,  40,  30, -10, -30,
+     -30, -10,  30,  40,  40,  30, -10, -30,
+     -30, -10,  20,  30,  30,  20, -10, -30,
+     -30, -30,   0,   0,   0,   0, -30, -30,
+     -50, -30, -30, -30, -30, -30, -30, -50},
+    {-20, -10, -10, -10, -10, -10, -10, -20,
+     -10,   0,   0,   0,   0,   0,   0, -10,
+     -10,   0,   5,  10,  10,   5,   0, -10,
+     -10,   5,   5,  10,  10,   5,   5, -10,
+     -10,   0,  10,  10,  10,  10,   0, -10,
+     -10,  10,  10,  10,  10,  10,  10, -10,
+     -10,   5,   0,   0,   0,   0,   5, -10,
+     -20, -10, -10, -10, -10, -10, -10, -20},
+    {  0,   0,   0,   0,   0,   0,   0,   0,
+       5,  10,  10,  10,  10,  10,  10,   5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+      -5,   0,   0,   0,   0,   0,   0,  -5,
+       0,   0,   0,   5,   5,   0,   0,   0},
+    {-20, -10, -10,  -5,  -5, -10, -10, -20,
+     -10,   0,   0,   0,   0,   0,   0, -10,
+     -10,   0,   5,   5,   5,   5,   0, -10,
+      -5,   0,   5,   5,   5,   5,   0,  -5,
+       0,   0,   5,   5,   5,   5,   0,  -5,
+     -10,   5,   5,   5,   5,   5,   0, -10,
+     -10,   0,   5,   0,   0,   0,   0, -10,
+     -20, -10, -10,  -5,  -5, -10, -10, -20}
+};
+
+void initEval() { /* Fill in the evaluation tables. Safe to call more than once {{{2 */
+    static char done = 0;
+    char type, sq, flip, file;
+    if(done) {
+        return;
+    }
+    for(sq = 0; sq < 64; ++sq) {
+        flip = (7 - (sq >> 3)) << 3 | (sq & 7); // The tables list rank 8 first
+        for(type = PAWN; type <= QUEEN; ++type) {
+            if(type == ENP) {
+                continue;
+            }
+            pst[type][sq] = worth[type] + S(squares[type][flip], type == KING ? squares[ENP][flip] : squares[type][flip]);
+            pst[type | BLACK][sq ^ 56] = -pst[type][sq];
+        }
+    }
+    for(file = 0; file < 8; ++file) {
+        files[file] = 0x0101010101010101ULL << file;
+    }
+    done = 1;
+}
+
+/* Evaluation {{{1 */
+#ifdef DEBUG
+static int scan(Game *game) { /* Material plus piece-square score summed from the rows, to check Game.psqt {{{2 */
+    unsigned int row, occupied;
+    int score = 0;
+    char rank, file;
+    for(rank = 0; rank < 8; ++rank) {
+        row = game->board[rank];
+        occupied = (row | row >> 1) & 0x11111111;   // One bit per nybble; only empty spots and en passant markers have both low bits clear
+        while(occupied) {
+            file = __builtin_ctz(occupied) >> 2;
+            score += pst[row >> (file << 2) & 0xF][rank << 3 | file];
+            occupied &= occupied - 1;
+        }
+    }
+    return score;
+}
+#endif
+
+static int structure(char color, Game *game) { /* Pawn structure score for one color, white positive {{{2 */
+    Bits own = game->bits[PAWN | color << 3];
+    Bits their = game->bits[PAWN | !color << 3];
+    Bits span = their;
+    Bits passers;
+    unsigned int taken = own | own >> 32;
+    int score;
+    char sq;
+    taken |= taken >> 16;
+    taken = (taken | taken >> 8) & 0xFF;    // Files holding one of our pawns
+    span |= color ? span << 8 : span >> 8;  // Spots their pawns stand on or will walk through
+    span |= color ? span << 16 : span >> 16;
+    span |= color ? span << 32 : span >> 32;
+    span |= (span & ~files[0]) >> 1 | (span & ~files[7]) << 1;
+    score = doubled * (__builtin_popcountll(own) - __builtin_popcount(taken))
+        + isolated * __builtin_popcountll(own & (taken & ~(taken << 1 | taken >> 1)) * files[0]);
+    for(passers = own & ~(color ? span << 8 : span >> 8); passers; passers &= passers - 1) {
+        sq = LSB(passers);
+        score += advance[color ? 7 - (sq >> 3) : sq >> 3];
+    }
+    return color ? -score : score;
+}
+
+static int mobile(char color, Game *game) { /* Mobility score for one color, white positive {{{2 */
+    static char types[4] = {KNIGHT, BISHOP, ROOK, QUEEN};
+    Bits pieces;
+    int score = 0;
+    char n, sq;
+    for(n = 0; n < 4; ++n) {
+        for(pieces = game->bits[types[n] | color << 3]; pieces; pieces &= pieces - 1) {
+            sq = LSB(pieces);
+            score += mobility[types[n]] * __builtin_popcountll(game->from[sq] & ~game->occ[color]);
+        }
+    }
+    return color ? -score : score;
+}
+
+int evaluate(Game *game) { /* Static score from the side to move's point of view {{{2 */
+    int score = game->psqt;
+    int phase;
+#ifdef DEBUG
+    assert(score == scan(game));
+#endif
+    score += structure(0, game) + structure(1, game) + mobile(0, game) + mobile(1, game);
+    phase = __builtin_popcountll(game->bits[KNIGHT] | game->bits[KNIGHT | BLACK] | game->bits[BISHOP] | game->bits[BISHOP | BLACK])
+        + 2 * __builtin_popcountll(game->bits[ROOK] | game->bits[ROOK | BLACK])
+        + 4 * __builtin_popcountll(game->bits[QUEEN] | game->bits[QUEEN | BLACK]);
+    if(phase > PHASE) {
+        phase = PHASE;  // Promotions can push it past the opening count
+    }
+    score = (MG(score) * phase + EG(score) * (PHASE - phase)) / PHASE;
+    return game->info.color ? -score : score;
+}
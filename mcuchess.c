@@ -16,25 +16,39 @@ typedef enum _Command {
         TERM} Command;                                                  //47
 
 void parseCmd(const char *command, char *cmd);
-char askUser(Move move);
 void mcuInit(int fd);
 void ardOut(int fd, char val);
 void mcuMove(int fd, Move move, Game *game);
-void mcuPos(int fd, Move *move);
+void mcuPos(int fd, Moves *moves);
 void reqRep();
 char *getInput();
 
 int main(int argc, char **argv) {
     int fd = open("/dev/ttyUSB0", O_RDWR | O_NOCTTY | O_SYNC);
     int i;
-    Game *game = newGame(askUser);
+    char opponent = (argc > 1) && (argv[1][0] == '-') && (argv[1][1] == 'c');   // -c: the engine answers each move
+    Game *game = newGame();
+    Table table;
+    Book book;
+    Limits think = {0, 1000, 0, &table, 1, NULL};
     char *command;
     char cmd[8];
     Move move;
+    Result result;
+    Moves moves;
     if(fd < 0) {
         free(game);
         return 1;
     }
+    if(opponent && !newTable(16, &table)) {
+        opponent = 0;
+    }
+    if(opponent && openBook(BOOK, &book)) {
+        think.book = &book;
+    }
+    if(opponent) {
+        openTablebases(TBDIR);
+    }
     mcuInit(fd);
     while(!game->info.mate) {
         command = getInput();
@@ -51,8 +65,17 @@ int main(int argc, char **argv) {
                 move.dst.file = cmd[5] - ALPHA;
                 move.dst.rank = cmd[6] - ONE;
                 move.capture = value(move.dst, game);
+                move.promo = ((move.piece & 0x7) == PAWN && move.dst.rank == ((move.piece & 0x8) ? 0 : 7)) ? QUEEN : EMPTY;  // The board can't ask, so pawns become queens
                 if(execMove(move, game) > 0) {
                     mcuMove(fd, move, game);
+                    if(opponent && !game->info.mate) {
+                        result = search(game, think);
+                        if(result.length && execMove(result.best, game) > 0) {
+                            mcuMove(fd, result.best, game);
+                        } else {
+                            printf("Engine has no move.\n");
+                        }
+                    }
                 } else {
                     printf("Fail move.\n");
                 }
@@ -60,7 +83,8 @@ int main(int argc, char **argv) {
             case POSSIBLE:
                 move.src.file = cmd[2] - ALPHA;
                 move.src.rank = cmd[3] - ONE;
-                mcuPos(fd, possible(move.src, game));
+                possible(move.src, game, &moves);
+                mcuPos(fd, &moves);
                 break;
             default:
                 reqRep();
@@ -81,10 +105,6 @@ char *getInput() {
     return str;
 }
 
-char askUser(Move move) {
-    return QUEEN;
-}
-
 Move getMove() {
     Move move;
     return move;
@@ -132,13 +152,12 @@ void mcuMove(int fd, Move move, Game *game) {
     ardOut(fd, 'x');
 }
 
-void mcuPos(int fd, Move *move) {
-    Move *curr;
-    curr = move;
+void mcuPos(int fd, Moves *moves) {
+    int i;
     ardOut(fd, 'p');
-    for(; curr->next; curr = curr->next) {
-        ardOut(fd, curr->dst.file + 2);
-        ardOut(fd, curr->dst.rank);
+    for(i = 0; i < moves->count; ++i) {
+        ardOut(fd, moves->move[i].dst.file + 2);
+        ardOut(fd, moves->move[i].dst.rank);
         ardOut(fd, 2);
     }
     ardOut(fd, 'x');
@@ -1,12 +1,20 @@
 #include <ncurses.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "chess.h"
 
 #define COLOR(file,rank) (((file) + (rank)) % 2 ? 1 : 2)
 #define MSG 10
 
+static Table table;
+static Book book;
+static Limits think = {0, 1000, 0, &table, 1, NULL};  // One second per engine move
+
 void printSpot(Pos spot, Game *game);
 void printBorder();
 void printBoard(Game *game);
+void play(Move move, Game *game);
 void user(Game *game);
 char getPromo();
 
@@ -24,7 +32,16 @@ int main(int argc, char **argv) {
     noecho();
 
     printBorder();
-    Game *game = newGame(getPromo);
+    if(!newTable(16, &table)) {
+        think.table = NULL; // Search without one rather than through an empty one
+    }
+    think.threads = sysconf(_SC_NPROCESSORS_ONLN);  // Every core helps the engine think
+    if(openBook(BOOK, &book)) {
+        think.book = &book; // Opening moves come straight from the book
+    }
+    openTablebases(TBDIR);  // Endgames with few pieces play perfectly when their tables are there
+    srand(time(NULL));  // So book games differ
+    Game *game = newGame();
     printBoard(game);
 
     user(game);
@@ -52,6 +69,7 @@ char getPromo() {
         case 'b':
             return BISHOP;
     }
+    return EMPTY;   // Anything else makes the move invalid
 }
 
 void printSpot(Pos spot, Game *game) {
@@ -94,22 +112,49 @@ void printBoard(Game *game) {
     }
 }
 
-void displayMoves(Move *move) {
-    Move *iter;
-    char n;
-    if(move == NULL) {
-        return;
+void displayMoves(Moves *moves) {
+    int i;
+    for(i = 0; i < moves->count; ++i) {
+        mvchgat(8-moves->move[i].dst.rank, 3*(1+moves->move[i].dst.file), 3, A_REVERSE, 3, NULL);
+    }
+}
+
+void play(Move move, Game *game) {
+    char ret = execMove(move, game);
+    if(ret > 0) {
+        printBoard(game);
     }
-    for(iter = move; iter->next; iter = iter->next) {
-        mvchgat(8-iter->dst.rank, 3*(1+iter->dst.file), 3, A_REVERSE, 3, NULL);
+    switch(ret) {
+        case TURN:
+            mvprintw(MSG, 0, "It's not your turn.");
+            break;
+        case INVALID:
+            mvprintw(MSG, 0, "That piece can't move like that.");
+            break;
+        case THREAT:
+            mvprintw(MSG, 0, "That would leave your king in check.");
+            break;
+        case CHECK:
+            mvprintw(MSG, 0, "Check!");
+            break;
+        case STALE:
+            mvprintw(MSG, 0, "Stalemate!");
+            break;
+        case MATE:
+            mvprintw(MSG, 0, "Checkmate!");
+            break;
+        case TIE:
+            mvprintw(MSG, 0, "Draw!");
+            break;
     }
+    clrtoeol;
 }
 
 void user(Game *game) {
     static char ch;
-    static char ret;
-    static Move *valid;
+    static Moves valid;
     static Move move;
+    Result result;
     static Pos pos;
     static char cursX = 0;
     static char cursY = 0;
@@ -132,8 +177,8 @@ void user(Game *game) {
             case 'v':
                 printBoard(game);
                 pos = (Pos){cursX, 7-cursY};
-                valid = possible(pos, game);
-                displayMoves(valid);
+                possible(pos, game, &valid);
+                displayMoves(&valid);
                 break;
             case 's':
                 move.src = (Pos){cursX, 7-cursY};
@@ -142,31 +187,20 @@ void user(Game *game) {
             case 'd':
                 move.dst = (Pos){cursX, 7-cursY};
                 move.capture = value(move.dst, game);
-                ret = execMove(move, game);
-                if(ret > 0) {
-                    printBoard(game);
-                }
-                switch(ret) {
-                    case TURN:
-                        mvprintw(MSG, 0, "It's not your turn.");
-                        break;
-                    case INVALID:
-                        mvprintw(MSG, 0, "That piece can't move like that.");
-                        break;
-                    case THREAT:
-                        mvprintw(MSG, 0, "That would leave your king in check.");
-                        break;
-                    case CHECK:
-                        mvprintw(MSG, 0, "Check!");
-                        break;
-                    case STALE:
-                        mvprintw(MSG, 0, "Stalemate!");
-                        break;
-                    case MATE:
-                        mvprintw(MSG, 0, "Checkmate!");
-                        break;
+                move.promo = ((move.piece & 0x7) == PAWN && move.dst.rank == ((move.piece & 0x8) ? 0 : 7)) ? getPromo() : EMPTY;
+                play(move, game);
+                break;
+            case 'c':
+                mvprintw(MSG, 0, "Thinking...");
+                clrtoeol();
+                refresh();
+                result = search(game, think);
+                if(result.length) {
+                    play(result.best, game);
+                } else {
+                    mvprintw(MSG, 0, "There's no move to make.");
+                    clrtoeol();
                 }
-                clrtoeol;
                 break;
         }
         mvchgat(1+cursY, 3*(1+cursX), 3, A_REVERSE, 3, NULL);
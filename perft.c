@@ -0,0 +1,401 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chess.h"
+
+#define MAXDEPTH 6
+#define SPLIT 3     // Shallowest subtree worth handing to an idle worker
+
+typedef struct _Suite {
+    const char *name;
+    const char *fen;
+    unsigned long long nodes[MAXDEPTH];
+} Suite;
+
+static Suite suite[] = {   // Reference positions and their known node counts by depth
+    {"start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        {20ULL, 400ULL, 8902ULL, 197281ULL, 4865609ULL, 119060324ULL}},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        {48ULL, 2039ULL, 97862ULL, 4085603ULL, 193690690ULL, 0ULL}},
+    {"endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        {14ULL, 191ULL, 2812ULL, 43238ULL, 674624ULL, 11030083ULL}},
+    {"promotion", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        {6ULL, 264ULL, 9467ULL, 422333ULL, 15833292ULL, 0ULL}},
+    {"talkchess", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        {44ULL, 1486ULL, 62379ULL, 2103487ULL, 89941194ULL, 0ULL}},
+    {"middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        {46ULL, 2079ULL, 89890ULL, 3894594ULL, 164075551ULL, 0ULL}}
+};
+
+typedef struct _Task {      // A subtree waiting to be counted
+    Game game;
+    char depth;
+    unsigned long long *count;  // Where its leaves are added
+} Task;
+
+typedef struct _Worker {    // A pool thread and the deque of tasks it owns
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Task **task;
+    int head, tail, size;   // Owner pops at the tail, thieves steal the older, bigger tasks at the head
+} Worker;
+
+typedef struct _Tally {     // Transposition table use, counted apart from the Table so threads don't fight over it
+    unsigned long long hits, misses, stores, collisions;
+} Tally;
+
+static struct {
+    Worker *worker;
+    int count;
+    volatile int pending;   // Tasks pushed but not yet counted
+    volatile int idle;      // Workers out of tasks; nonzero asks busy ones to split
+} pool;
+
+static __thread Worker *self;       // This thread's worker, NULL outside the pool
+static __thread Task *current;      // Task this worker is counting
+static __thread unsigned int splits;    // Bumped whenever part of a subtree is handed off
+static __thread Tally mine;         // This thread's table use, until settle() adds it to used
+static Tally used;                  // Table use by every thread that has finished
+static Table table; // Subtree counts by position and depth, when enabled
+static char hashed = 0;
+static int jobs = 1;    // Worker threads for counting
+
+Task *task(Game *game, char depth, unsigned long long *count);
+void push(Worker *worker, Task *task);
+
+void settle() { /* Add this thread's table counters to the totals */
+    __sync_fetch_and_add(&used.hits, mine.hits);
+    __sync_fetch_and_add(&used.misses, mine.misses);
+    __sync_fetch_and_add(&used.stores, mine.stores);
+    __sync_fetch_and_add(&used.collisions, mine.collisions);
+    memset(&mine, 0, sizeof(mine));
+}
+
+unsigned long long perft(char depth, char divide, Game *game) { /* Count leaf nodes of the legal move tree */
+    static char *reps = REPS;
+    unsigned long long nodes = 0;
+    unsigned long long count;
+    unsigned long long data;
+    unsigned int before = splits;
+    char split;
+    Moves list;
+    Move *curr;
+    if(depth == 0) {
+        return 1;
+    }
+    if(hashed && !divide && depth > 1) {
+        if(probe(game->key, &table, &data) && DEPTH(data) == depth) {
+            ++mine.hits;
+            return data >> 8;   // Already counted this subtree
+        }
+        ++mine.misses;  // Counted at another depth is no help: the subtree gets counted again
+    }
+    split = self && pool.idle && depth >= SPLIT && self->head == self->tail;
+    generateAll(game, &list);
+    for(curr = list.move; curr < list.move + list.count; ++curr) {
+        if(execMove(*curr, game) <= 0) {
+            fprintf(stderr, "execMove rejected a move from generateAll()\n");
+            continue;
+        }
+        if(split) {
+            push(self, task(game, depth - 1, current->count));
+            unmakeMove(game);
+            continue;   // Its leaves go straight to the task's total
+        }
+        count = perft(depth - 1, 0, game);
+        unmakeMove(game);
+        if(divide) {
+            printf("%c%d%c%d%.1s: %llu\n", 'a' + curr->src.file, curr->src.rank + 1, 'a' + curr->dst.file, curr->dst.rank + 1,
+                    curr->promo ? &reps[curr->promo | 0x8] : "", count);
+        }
+        nodes += count;
+    }
+    if(split) {
+        ++splits;
+    }
+    if(hashed && depth > 1 && splits == before) {   // A split count is missing the handed off part
+        mine.collisions += store(game->key, nodes << 8 | depth, &table);
+        ++mine.stores;
+    }
+    return nodes;
+}
+
+/* Work stealing pool */
+Task *task(Game *game, char depth, unsigned long long *count) { /* Package the position for a worker */
+    Task *task = malloc(sizeof(Task));
+    if(!task) {
+        fprintf(stderr, "Out of memory for perft tasks\n");
+        exit(2);
+    }
+    copyGame(&task->game, game);
+    task->depth = depth;
+    task->count = count;
+    return task;
+}
+
+void push(Worker *worker, Task *task) { /* Add a task to the tail of a worker's deque */
+    __sync_fetch_and_add(&pool.pending, 1);
+    pthread_mutex_lock(&worker->lock);
+    if(worker->tail == worker->size) {
+        if(worker->head) {  // Slide down over the stolen slots before growing
+            for(worker->tail = 0; worker->head + worker->tail < worker->size; ++worker->tail) {
+                worker->task[worker->tail] = worker->task[worker->head + worker->tail];
+            }
+            worker->head = 0;
+        }
+        if(worker->tail == worker->size) {
+            worker->size = worker->size ? worker->size * 2 : 64;
+            worker->task = realloc(worker->task, worker->size * sizeof(Task *));
+            if(!worker->task) {
+                fprintf(stderr, "Out of memory for perft tasks\n");
+                exit(2);
+            }
+        }
+    }
+    worker->task[worker->tail++] = task;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+Task *take(Worker *worker, char steal) { /* Pop the newest task, or steal the oldest; NULL if empty */
+    Task *task = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if(worker->head < worker->tail) {
+        task = steal ? worker->task[worker->head++] : worker->task[--worker->tail];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+Task *next(Worker *worker) { /* Find this worker's next task, waiting until every task is done */
+    Task *task;
+    char idle = 0;
+    int n;
+    while(!(task = take(worker, 0))) {
+        for(n = 1; n < pool.count && !task; ++n) {
+            task = take(pool.worker + (worker - pool.worker + n) % pool.count, 1);
+        }
+        if(task) {
+            break;
+        }
+        if(!pool.pending) {
+            break;
+        }
+        if(!idle) {
+            __sync_fetch_and_add(&pool.idle, 1);
+            idle = 1;
+        }
+        sched_yield();
+    }
+    if(idle) {
+        __sync_fetch_and_sub(&pool.idle, 1);
+    }
+    return task;
+}
+
+void *work(void *arg) { /* Pool thread: count tasks until none are left anywhere */
+    self = arg;
+    while((current = next(self))) {
+        __sync_fetch_and_add(current->count, perft(current->depth, 0, &current->game));
+        free(current);
+        __sync_fetch_and_sub(&pool.pending, 1);
+    }
+    settle();
+    return NULL;
+}
+
+unsigned long long parallel(char depth, char divide, Game *game, int threads) { /* perft with root moves shared out to threads */
+    static char *reps = REPS;
+    unsigned long long counts[MAXMOVES];
+    unsigned long long nodes = 0;
+    Moves list;
+    Move *curr;
+    int n, moves = 0;
+    if(depth < 2 || threads < 2) {
+        nodes = perft(depth, divide, game);
+        settle();
+        return nodes;
+    }
+    pool.worker = calloc(threads, sizeof(Worker));
+    if(!pool.worker) {
+        return perft(depth, divide, game);
+    }
+    pool.count = threads;
+    pool.pending = pool.idle = 0;
+    for(n = 0; n < threads; ++n) {
+        pthread_mutex_init(&pool.worker[n].lock, NULL);
+    }
+    generateAll(game, &list);
+    for(curr = list.move; curr < list.move + list.count; ++curr, ++moves) {    // Deal the root moves out round robin
+        counts[moves] = 0;
+        if(execMove(*curr, game) <= 0) {
+            fprintf(stderr, "execMove rejected a move from generateAll()\n");
+            continue;
+        }
+        push(pool.worker + moves % threads, task(game, depth - 1, counts + moves));
+        unmakeMove(game);
+    }
+    for(n = 0; n < threads; ++n) {
+        pthread_create(&pool.worker[n].thread, NULL, work, pool.worker + n);
+    }
+    for(n = 0; n < threads; ++n) {
+        pthread_join(pool.worker[n].thread, NULL);
+        pthread_mutex_destroy(&pool.worker[n].lock);
+        free(pool.worker[n].task);
+    }
+    free(pool.worker);
+    for(moves = 0; moves < list.count; ++moves) {  // Same order and format as perft()
+        curr = list.move + moves;
+        if(divide) {
+            printf("%c%d%c%d%.1s: %llu\n", 'a' + curr->src.file, curr->src.rank + 1, 'a' + curr->dst.file, curr->dst.rank + 1,
+                    curr->promo ? &reps[curr->promo | 0x8] : "", counts[moves]);
+        }
+        nodes += counts[moves];
+    }
+    return nodes;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long timed(char depth, char divide, Game *game, double *secs) {
+    double start = now();
+    unsigned long long nodes = parallel(depth, divide, game, jobs);
+    *secs = now() - start;
+    return nodes;
+}
+
+int runSuite(char maxdepth) { /* Run every reference position up to maxdepth, returning the failure count */
+    Game *game = newGame();
+    unsigned long long nodes, total = 0;
+    double secs, elapsed = 0;
+    int fails = 0;
+    int i;
+    char depth;
+    for(i = 0; i < sizeof(suite)/sizeof(suite[0]); ++i) {
+        loadFen(suite[i].fen, game);
+        for(depth = 1; depth <= maxdepth && suite[i].nodes[depth-1]; ++depth) {
+            nodes = timed(depth, 0, game, &secs);
+            total += nodes;
+            elapsed += secs;
+            fails += nodes != suite[i].nodes[depth-1];
+            printf("%-10s %d %12llu %12llu %8.3fs %10.0f nps %s\n", suite[i].name, depth, nodes, suite[i].nodes[depth-1],
+                    secs, nodes / (secs > 0 ? secs : 1e-9), nodes == suite[i].nodes[depth-1] ? "ok" : "FAIL");
+        }
+    }
+    printf("total %llu nodes in %.3fs, %.0f nps, %d failed\n", total, elapsed, total / (elapsed > 0 ? elapsed : 1e-9), fails);
+    free(game);
+    return fails;
+}
+
+int single(char depth, const char *fen) { /* Print per-move counts for a single position */
+    Game *game = newGame();
+    double secs;
+    unsigned long long nodes;
+    if(!loadFen(fen, game)) {
+        fprintf(stderr, "Bad FEN: %s\n", fen);
+        free(game);
+        return 1;
+    }
+    nodes = timed(depth, 1, game, &secs);
+    printf("%llu nodes in %.3fs, %.0f nps\n", nodes, secs, nodes / (secs > 0 ? secs : 1e-9));
+    free(game);
+    return 0;
+}
+
+int bench(int depth) { /* Search every reference position to depth on threads threads */
+    Game *game = newGame();
+    Limits limits = {0, 0, 0, &table, 1, NULL};
+    Result result;
+    unsigned long long total = 0, qnodes = 0, cutoffs = 0, firsts = 0;
+    unsigned int elapsed = 0;
+    int i;
+    limits.depth = depth;
+    limits.threads = jobs;
+    if(!hashed && !newTable(64, &table)) {  // Threads only help each other through the table
+        fprintf(stderr, "Couldn't allocate 64 MB table\n");
+        free(game);
+        return 2;
+    }
+    hashed = 1;
+    for(i = 0; i < sizeof(suite)/sizeof(suite[0]); ++i) {
+        loadFen(suite[i].fen, game);
+        clearTable(&table);
+        result = search(game, limits);
+        total += result.nodes;
+        qnodes += result.qnodes;
+        cutoffs += result.cutoffs;
+        firsts += result.firsts;
+        used.hits += result.hits;
+        used.misses += result.misses;
+        used.stores += result.stores;
+        used.collisions += result.collisions;
+        elapsed += result.time;
+        printf("%-10s %d %6d %12llu %8.3fs %10.0f nps %c%d%c%d\n", suite[i].name, result.depth, result.score, result.nodes,
+                result.time / 1000.0, result.nodes * 1000.0 / (result.time ? result.time : 1),
+                'a' + result.best.src.file, result.best.src.rank + 1, 'a' + result.best.dst.file, result.best.dst.rank + 1);
+    }
+    printf("total %llu nodes in %.3fs, %.0f nps on %d threads\n", total, elapsed / 1000.0, total * 1000.0 / (elapsed ? elapsed : 1), jobs);
+    printf("%llu quiescence nodes (%.1f%%)\n", qnodes, total ? 100.0 * qnodes / total : 0.0);
+    printf("%llu cutoffs, %.1f%% on the first move\n", cutoffs, cutoffs ? 100.0 * firsts / cutoffs : 0.0);
+    free(game);
+    return 0;
+}
+
+void report() { /* Print the transposition table counters */
+    if(hashed) {
+        printf("table %llu buckets: %llu hits, %llu misses, %llu stores, %llu collisions\n",
+                table.mask + 1, used.hits, used.misses, used.stores, used.collisions);
+    }
+}
+
+int main(int argc, char **argv) {
+    char depth = 3;
+    int searching = 0;
+    int opt, ret;
+    char bad = 0;
+    while(!bad && (opt = getopt(argc, argv, "t:s:j:")) != -1) {
+        switch(opt) {
+            case 't':   // Transposition table size in megabytes
+                if(!newTable(atoi(optarg), &table)) {
+                    fprintf(stderr, "Couldn't allocate %s MB table\n", optarg);
+                    return 2;
+                }
+                hashed = 1;
+                break;
+            case 's':   // Search to this depth instead of counting
+                searching = atoi(optarg);
+                break;
+            case 'j':   // Threads to count or search with
+                jobs = atoi(optarg) > 1 ? atoi(optarg) : 1;
+                break;
+            default:    // getopt() has already named the bad option
+                bad = 1;
+        }
+    }
+    if(searching > 0 && !bad) {
+        ret = bench(searching > MAXPLY ? MAXPLY : searching);
+        report();
+        return ret;
+    }
+    if(optind < argc) {
+        depth = atoi(argv[optind]);
+    }
+    if(bad || depth < 1 || depth > MAXDEPTH) {
+        fprintf(stderr, "usage: %s [-t MB] [-j threads] [depth 1-%d] [fen]\n       %s [-t MB] -s depth [-j threads]\n", argv[0], MAXDEPTH, argv[0]);
+        return 2;
+    }
+    if(optind + 1 < argc) {
+        ret = single(depth, argv[optind + 1]);
+    } else {
+        ret = runSuite(depth) ? 1 : 0;
+    }
+    report();
+    return ret;
+}
@@ -0,0 +1,183 @@
+#include <string.h>
+#include "chess.h"
+
+#define START "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+static const char *skip(const char *text, const char *end);
+
+/* Helpers {{{1 */
+static const char *skip(const char *text, const char *end) { /* Step over space, comments, variations and NAGs {{{2 */
+    int depth = 0;
+    while(text < end) {
+        if(*text == '{') {
+            for(; text < end && *text != '}'; ++text);
+        } else if(*text == ';') {
+            for(; text < end && *text != '\n'; ++text);
+        } else if(*text == '$') {
+            for(++text; text < end && *text >= '0' && *text <= '9'; ++text);
+            continue;
+        } else if(*text == '(') {
+            ++depth;    // Variations can nest; only the main line is replayed
+        } else if(*text == ')') {
+            depth -= depth > 0;
+        } else if(!depth && !strchr(" \t\r\n", *text)) {
+            break;
+        }
+        ++text;
+    }
+    return text;
+}
+
+/* SAN {{{1 */
+char sanMove(const char *san, int length, Game *game, Move *move) { /* Find the one legal move san names. Returns 0 if none or several {{{2 */
+    static char *pieces = "  NK BRQ";
+    char type = PAWN, promo = 0, found = 0;
+    char file = -1, rank = -1, from = -1, fromRank = -1;
+    Bits candidates;
+    Moves list;
+    Pos spot;
+    int n;
+    if(length && (*san == 'O' || *san == '0')) {    // Castling names the king's move
+        for(n = 0; n < length && strchr("O0-", san[n]); ++n);
+        spot = game->king[game->info.color];
+        move->piece = KING | game->info.color << 3;
+        move->capture = EMPTY;
+        move->src = spot;
+        move->dst = (Pos){n > 3 ? 2 : 6, spot.rank};
+        possible(spot, game, &list);
+        for(n = 0; n < list.count; ++n) {
+            if(SQ(list.move[n].dst) == SQ(move->dst)) {
+                *move = list.move[n];
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if(length && strchr("NBRQK", *san)) {
+        type = strchr(pieces, *san) - pieces;
+        ++san;
+        --length;
+    }
+    for(n = 0; n < length; ++n) {
+        if(san[n] >= 'a' && san[n] <= 'h') {
+            from = file;
+            file = san[n] - 'a';
+        } else if(san[n] >= '1' && san[n] <= '8') {
+            fromRank = rank;
+            rank = san[n] - '1';
+        } else if(san[n] && strchr("NBRQ", san[n])) {
+            promo = strchr(pieces, san[n]) - pieces;
+        } else if(!strchr("x:-=", san[n])) {
+            return 0;
+        }
+    }
+    if(file < 0 || rank < 0 || (promo && type != PAWN)) {
+        return 0;
+    }
+    for(candidates = game->bits[type | game->info.color << 3]; candidates; candidates &= candidates - 1) {
+        spot = POS(LSB(candidates));
+        if((from >= 0 && spot.file != from) || (fromRank >= 0 && spot.rank != fromRank)) {
+            continue;
+        }
+        possible(spot, game, &list);
+        for(n = 0; n < list.count; ++n) {
+            if(list.move[n].dst.file == file && list.move[n].dst.rank == rank && list.move[n].promo == promo) {
+                *move = list.move[n];
+                ++found;
+            }
+        }
+    }
+    return found == 1;  // Promotions only match when they name their piece, and nothing else may name one
+}
+
+/* Games {{{1 */
+const char *nextPgn(const char *text, const char *end) { /* Start of the game after the one at text, or NULL if it may run past end {{{2 */
+    const char *token;
+    char moves = 0;
+    int depth = 0;
+    while(text < end) {
+        if(*text == '{') {
+            for(; text < end && *text != '}'; ++text);
+        } else if(*text == ';') {
+            for(; text < end && *text != '\n'; ++text);
+        } else if(*text == '(') {
+            ++depth;
+        } else if(*text == ')') {
+            depth -= depth > 0;
+        } else if(*text == '[' && !depth) {
+            if(moves) {
+                return text;    // A tag after movetext starts a new game
+            }
+            for(; text < end && *text != '\n'; ++text);
+        } else if(!strchr(" \t\r\n", *text)) {
+            for(token = text++; text < end && !strchr(" \t\r\n{};()[$", *text); ++text);
+            if(!depth && (*token == '*' || (text - token >= 3 && (!strncmp(token, "1-0", 3) || !strncmp(token, "0-1", 3)
+                                || !strncmp(token, "1/2", 3))))) {
+                for(; text < end && strchr(" \t\r\n", *text); ++text);
+                return text < end ? text : NULL;    // A result ends the game, tags or not
+            }
+            moves = 1;
+            continue;
+        }
+        ++text;
+    }
+    return NULL;
+}
+
+int replayPgn(const char *text, const char *end, Game *game, void (*seen)(Game *, Move *, void *), void *arg, Replay *replay) { /* Play a game's main line. Returns the plies played, or -1 with replay->error set {{{2 */
+    const char *token, *tag;
+    char fen[128];
+    Move move;
+    int length, n;
+    replay->plies = 0;
+    replay->error = NULL;
+    replay->san[0] = '\0';
+    strcpy(fen, START);
+    for(text = skip(text, end); text < end && *text == '['; text = skip(text, end)) {
+        for(tag = text; text < end && *text != '\n'; ++text);
+        if(text - tag > 6 && !strncmp(tag, "[FEN \"", 6)) { // Games can start from a set up position
+            for(tag += 6, length = 0; tag < text && *tag != '"' && length < sizeof(fen) - 1; ) {
+                fen[length++] = *tag++;
+            }
+            fen[length] = '\0';
+        }
+    }
+    if(!loadFen(fen, game)) {
+        replay->error = "bad FEN";
+        return -1;
+    }
+    for(; text < end; text = skip(text, end)) {
+        for(token = text; text < end && !strchr(" \t\r\n{};()$", *text); ++text);
+        if(*token == '*' || *token == '[' || (text - token >= 3 && (!strncmp(token, "1-0", 3) || !strncmp(token, "0-1", 3)
+                        || !strncmp(token, "1/2", 3)))) {
+            break;  // A result ends the game
+        }
+        for(n = 0; token + n < text && token[n] >= '0' && token[n] <= '9'; ++n);
+        if(token + n < text && token[n] == '.') {   // Move numbers, possibly run into the move
+            for(token += n; token < text && *token == '.'; ++token);
+        }
+        if(token == text) {
+            continue;
+        }
+        for(length = text - token; length && strchr("+#!?", token[length - 1]); --length);
+        n = length < sizeof(replay->san) ? length : sizeof(replay->san) - 1;
+        strncpy(replay->san, token, n);
+        replay->san[n] = '\0';
+        if(!sanMove(token, length, game, &move)) {
+            replay->error = "illegal or ambiguous move";
+            break;
+        }
+        if(seen) {
+            seen(game, &move, arg);
+        }
+        if(execMove(move, game) <= 0) {
+            replay->error = "move rejected";
+            break;
+        }
+        ++replay->plies;
+    }
+    if(seen && !replay->error) {
+        seen(game, NULL, arg);  // The final position
+    }
+    return replay->error ? -1 : replay->plies;
+}
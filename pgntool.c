@@ -0,0 +1,194 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chess.h"
+
+#define CHUNK (16 << 20)    // Bytes read at a time; grown if one game doesn't fit
+
+typedef struct _Text {      // One game's text and what replaying it found
+    const char *start, *end;
+    Replay replay;
+    Record *record;         // Positions seen, when writing a database
+    int records, room;
+} Text;
+
+typedef struct _Worker {
+    pthread_t thread;
+    Game *game;
+} Worker;
+
+static Text *texts;
+static int games, room;     // Games split out of the current chunk, and space for them
+static volatile int claimed;
+static FILE *out = NULL;    // Database being written, if any
+static char verbose = 0;
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void keep(Game *game, Move *move, void *arg) { /* replayPgn() callback saving each position as a record */
+    Text *text = arg;
+    if(text->records == text->room) {
+        text->room = text->room ? text->room * 2 : 128;
+        if(!(text->record = realloc(text->record, text->room * sizeof(Record)))) {
+            fprintf(stderr, "Out of memory for records\n");
+            exit(2);
+        }
+    }
+    packRecord(game, text->record + text->records++);
+}
+
+void add(const char *start, const char *end) { /* Queue a game's text for the workers */
+    if(games == room) {
+        room = room ? room * 2 : 1024;
+        if(!(texts = realloc(texts, room * sizeof(Text)))) {
+            fprintf(stderr, "Out of memory for games\n");
+            exit(2);
+        }
+    }
+    texts[games].start = start;
+    texts[games].end = end;
+    texts[games].record = NULL;
+    texts[games].records = texts[games].room = 0;
+    ++games;
+}
+
+void *work(void *arg) { /* Replay games from the chunk until it runs out */
+    Worker *self = arg;
+    int n;
+    while((n = __sync_fetch_and_add(&claimed, 1)) < games) {
+        replayPgn(texts[n].start, texts[n].end, self->game, out ? keep : NULL, texts + n, &texts[n].replay);
+    }
+    return NULL;
+}
+
+int run(FILE *in, int threads) { /* Stream in a chunk at a time, replaying its games in parallel and reporting in order */
+    Worker *workers = calloc(threads, sizeof(Worker));
+    unsigned long long number = 0, bad = 0, plies = 0, bytes = 0;
+    unsigned long long size = CHUNK, have = 0;
+    char *buffer = malloc(size);
+    const char *start, *next, *blank;
+    double begin = now();
+    char eof = 0;
+    int n;
+    if(!workers || !buffer) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    for(n = 0; n < threads; ++n) {
+        workers[n].game = newGame();
+    }
+    while(!eof || have) {
+        if(!eof) {
+            n = fread(buffer + have, 1, size - have, in);
+            eof = have + n < size;
+            have += n;
+            bytes += n;
+        }
+        games = 0;
+        for(start = buffer; (next = nextPgn(start, buffer + have)); start = next) {
+            add(start, next);
+        }
+        if(eof) {
+            for(blank = start; blank < buffer + have && strchr(" \t\r\n", *blank); ++blank);
+            if(blank < buffer + have) {
+                add(start, buffer + have);  // Nothing else is coming, so the rest is the last game
+            }
+            start = buffer + have;
+        } else if(start == buffer) {
+            if(!(buffer = realloc(buffer, size *= 2))) {    // A single game bigger than the buffer
+                fprintf(stderr, "Out of memory for a %llu byte game\n", size / 2);
+                return 2;
+            }
+            continue;
+        }
+        claimed = 0;
+        for(n = 1; n < threads; ++n) {
+            pthread_create(&workers[n].thread, NULL, work, workers + n);
+        }
+        work(workers);
+        for(n = 1; n < threads; ++n) {
+            pthread_join(workers[n].thread, NULL);
+        }
+        for(n = 0; n < games; ++n, ++number) {
+            plies += texts[n].replay.plies;
+            if(texts[n].replay.error) {
+                ++bad;
+                printf("game %llu: %s at ply %d: %s\n", number + 1, texts[n].replay.error, texts[n].replay.plies + 1, texts[n].replay.san);
+            } else if(verbose) {
+                printf("game %llu: ok, %d plies\n", number + 1, texts[n].replay.plies);
+            }
+            if(out) {
+                if(!texts[n].replay.error) {    // A broken game's positions may not be the game that was played
+                    fwrite(texts[n].record, sizeof(Record), texts[n].records, out);
+                }
+                free(texts[n].record);
+            }
+        }
+        memmove(buffer, start, buffer + have - start);
+        have -= start - buffer;
+    }
+    fprintf(stderr, "%llu games, %llu with errors, %llu plies, %.1f MB in %.3fs\n", number, bad, plies, bytes / 1048576.0, now() - begin);
+    for(n = 0; n < threads; ++n) {
+        free(workers[n].game);
+    }
+    free(workers);
+    free(buffer);
+    free(texts);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    DbHeader header;
+    char *output = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, ret;
+    char bad = 0;
+    while(!bad && (opt = getopt(argc, argv, "j:o:v")) != -1) {
+        switch(opt) {
+            case 'j':   // Worker threads
+                threads = atoi(optarg);
+                break;
+            case 'o':   // Write every position reached to this database
+                output = optarg;
+                break;
+            case 'v':   // Report good games too
+                verbose = 1;
+                break;
+            default:    // getopt() has already named the bad option
+                bad = 1;
+        }
+    }
+    if(bad || optind + 1 < argc) {
+        fprintf(stderr, "usage: %s [-j threads] [-o out.db] [-v] [games.pgn]\n", argv[0]);
+        return 2;
+    }
+    if(optind < argc && strcmp(argv[optind], "-") && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 2;
+    }
+    if(output) {
+        if(!(out = fopen(output, "wb"))) {
+            perror(output);
+            return 2;
+        }
+        newHeader(&header);
+        fwrite(&header, sizeof(header), 1, out);
+    }
+    ret = run(in, threads > 0 ? threads : 1);
+    if(out && fclose(out)) {
+        perror(output);
+        ret = 2;
+    }
+    if(in != stdin) {
+        fclose(in);
+    }
+    return ret;
+}
@@ -0,0 +1,446 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chess.h"
+
+#define INF 32767
+#define EXACT 3
+#define LOWER 1 // Score is at least the stored value
+#define UPPER 2 // Score is at most the stored value
+#define CAPTURE (1 << 20)   // Ordering scores: captures and promotions by MVV-LVA,
+#define KILLER  (1 << 19)   // then killer moves, then quiet moves by history below this
+
+typedef enum _Stage {HASH, RATE, SELECT} Stage;
+
+typedef struct _Picker {    // One node's moves, handed out best first
+    Moves list;
+    int score[MAXMOVES];
+    int next;               // Moves before this have been handed out
+    Stage stage;            // Table's move up front, then rate the rest, then select among them
+} Picker;
+
+typedef struct _Search {    // State for one thread of a run of search()
+    Limits limits;
+    double start;
+    volatile char *stop;    // Shared by every thread, so any of them can end the search
+    struct _Search *team;   // Every thread's state, for summing nodes
+    int id;                 // 0 is the main thread, whose result is kept
+    unsigned long long nodes;
+    unsigned long long qnodes;  // Nodes of quiescence search, counted in nodes too
+    unsigned long long cutoffs, firsts; // Beta cutoffs, and those the first move tried caused
+    unsigned long long hits, misses, stores, collisions;    // Table use, kept here so threads never write to the Table
+    Move killers[MAXPLY + 1][2];    // Latest quiet moves to cause a cutoff at each ply
+    int history[16][64];    // Cutoffs by quiet moves of each piece to each spot, deeper ones counting more
+    int length[MAXPLY + 1];
+    Move pv[MAXPLY + 1][MAXPLY + 1];    // Triangular principal variation table
+    Game game;              // Private copy of the root position
+    Result result;
+} Search;
+
+static double seconds();
+static unsigned long long pack(Move move, int score, int bound, int depth, int ply);
+static void expired(Search *s);
+static char same(Move a, Move b);
+static int rate(Move move, int ply, Search *s);
+static void prepare(Picker *picker, Move hash);
+static char pick(Picker *picker, int ply, Search *s, Move *move);
+static void reward(Move move, int depth, int ply, Search *s);
+static int see(Move move, Game *game);
+static int quiesce(int alpha, int beta, int ply, Search *s, Game *game);
+static int negamax(int depth, int alpha, int beta, int ply, Search *s, Game *game);
+static void *deepen(void *arg);
+
+/* Helpers {{{1 */
+static double seconds() { /* Seconds on a monotonic clock {{{2 */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long pack(Move move, int score, int bound, int depth, int ply) { /* Transposition table data for a node {{{2 */
+    if(score > WIN - MATES) {
+        score += ply;   // Mate scores are stored relative to the node, not the root
+    } else if(score < -WIN + MATES) {
+        score -= ply;
+    }
+    return (unsigned long long)packMove(move) << 32 | (unsigned long long)(score + INF) << 16 | bound << 8 | depth;
+}
+
+static void expired(Search *s) { /* Stop the search once a limit runs out {{{2 */
+    unsigned long long nodes = 0;
+    int n;
+    if(s->limits.nodes) {
+        for(n = 0; n < s->limits.threads; ++n) {
+            nodes += s->team[n].nodes;  // Other threads' counts may lag a little; close enough
+        }
+        if(nodes >= s->limits.nodes) {
+            *s->stop = 1;
+        }
+    }
+    if(s->limits.time && (seconds() - s->start) * 1000 >= s->limits.time) {
+        *s->stop = 1;
+    }
+}
+
+/* Move ordering {{{1 */
+static char same(Move a, Move b) { /* Do two moves go between the same spots, promoting alike? {{{2 */
+    return SQ(a.src) == SQ(b.src) && SQ(a.dst) == SQ(b.dst) && a.promo == b.promo;
+}
+
+static int rate(Move move, int ply, Search *s) { /* Ordering score of a move other than the table's {{{2 */
+    static const int worth[8] = {0, 1, 3, 50, 1, 3, 5, 9};  // By type; an en passant marker stands for its pawn
+    char type = move.piece & 0x7, victim = move.capture & 0x7;
+    if((move.capture & 0x3) || (victim == ENP && type == PAWN)) {
+        return CAPTURE + (worth[(int)victim] + worth[move.promo]) * 16 - worth[(int)type]; // Most valuable victim, then least valuable attacker
+    }
+    if(move.promo == QUEEN) {
+        return CAPTURE + worth[QUEEN] * 16 - worth[PAWN];   // Underpromotions are left with the quiet moves
+    }
+    if(same(move, s->killers[ply][0])) {
+        return KILLER + 1;
+    }
+    if(same(move, s->killers[ply][1])) {
+        return KILLER;
+    }
+    return s->history[move.piece][SQ(move.dst)];
+}
+
+static void prepare(Picker *picker, Move hash) { /* Put the table's move up front, leaving the rest unscored until it fails {{{2 */
+    Move move;
+    int n;
+    picker->next = 0;
+    picker->stage = RATE;
+    for(n = 0; n < picker->list.count; ++n) {
+        if(same(picker->list.move[n], hash)) {
+            move = picker->list.move[n];
+            picker->list.move[n] = picker->list.move[0];
+            picker->list.move[0] = move;
+            picker->stage = HASH;
+            break;
+        }
+    }
+}
+
+static char pick(Picker *picker, int ply, Search *s, Move *move) { /* Next best move. Returns 0 once they run out {{{2 */
+    Move swap;
+    int n, best = picker->next, score;
+    if(picker->next >= picker->list.count) {
+        return 0;
+    }
+    if(picker->stage == HASH) { // Often cuts off on its own, and then nothing else needs scoring
+        picker->stage = RATE;
+        *move = picker->list.move[picker->next++];
+        return 1;
+    }
+    if(picker->stage == RATE) {
+        for(n = picker->next; n < picker->list.count; ++n) {
+            picker->score[n] = rate(picker->list.move[n], ply, s);
+        }
+        picker->stage = SELECT;
+    }
+    for(n = best + 1; n < picker->list.count; ++n) {    // Selection sort, one step at a time
+        if(picker->score[n] > picker->score[best]) {
+            best = n;
+        }
+    }
+    swap = picker->list.move[best];
+    score = picker->score[best];
+    picker->list.move[best] = picker->list.move[picker->next];
+    picker->score[best] = picker->score[picker->next];
+    picker->list.move[picker->next] = swap;
+    picker->score[picker->next] = score;
+    *move = picker->list.move[picker->next++];
+    return 1;
+}
+
+static void reward(Move move, int depth, int ply, Search *s) { /* Remember a quiet move that caused a cutoff {{{2 */
+    int *entry = &s->history[move.piece][SQ(move.dst)];
+    int piece, sq;
+    if(!same(move, s->killers[ply][0])) {
+        s->killers[ply][1] = s->killers[ply][0];
+        s->killers[ply][0] = move;
+    }
+    if((*entry += depth * depth) >= KILLER) {
+        for(piece = 0; piece < 16; ++piece) {   // Keep history below the killers, favoring recent cutoffs
+            for(sq = 0; sq < 64; ++sq) {
+                s->history[piece][sq] /= 2;
+            }
+        }
+    }
+}
+
+static int see(Move move, Game *game) { /* Material a capture wins once every exchange on its spot is played out {{{2 */
+    static const int worth[8] = {0, 100, 300, 20000, 100, 300, 500, 900};
+    static const char cheapest[6] = {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING};
+    Bits occ = game->occ[0] | game->occ[1], from = 1ULL << SQ(move.src), attack;
+    char sq = SQ(move.dst), side = move.piece >> 3, type = move.piece & 0x7;
+    int gain[32], d = 0, n;
+    gain[0] = worth[move.capture & 0x7];
+    if((move.capture & 0x7) == ENP) {
+        occ &= ~(1ULL << (SQ(move.src) & 0x38 | move.dst.file));    // The pawn taken en passant isn't on sq
+    }
+    do {    // Each side in turn takes back with its least valuable attacker
+        ++d;
+        gain[d] = worth[(int)type] - gain[d - 1];
+        if((-gain[d - 1] > gain[d] ? -gain[d - 1] : gain[d]) < 0) {
+            break;  // Whether this side takes or not, it can't come out ahead
+        }
+        occ &= ~from;   // Pieces lined up behind it may now reach sq
+        side = !side;
+        attack = attackers(side, sq, occ, game) & occ;
+        for(n = 0; n < 6 && !(from = attack & game->bits[(type = cheapest[n]) | side << 3]); ++n);
+        from &= -from;
+    } while(from && d < 31);
+    while(--d) {
+        gain[d - 1] = -(-gain[d - 1] > gain[d] ? -gain[d - 1] : gain[d]);
+    }
+    return gain[0];
+}
+
+/* Search {{{1 */
+static int negamax(int depth, int alpha, int beta, int ply, Search *s, Game *game) { /* Alpha-beta in negamax form {{{2 */
+    unsigned long long data;
+    Picker picker;
+    Move hash, move, best;
+    int score, top = -INF;
+    int bound = UPPER;
+    int n;
+    s->length[ply] = ply;
+    if(!(++s->nodes & 1023)) {
+        expired(s);
+    }
+    if(*s->stop) {
+        return 0;
+    }
+    if(ply && (game->noCap >= 100 || repetitions(game))) {
+        return 0;   // Fifty moves without a capture or pawn move, or a position seen before
+    }
+    if(ply && __builtin_popcountll(game->occ[0] | game->occ[1]) <= TBMEN && probeTablebase(game, &score)) {
+        return score > 0 ? score - ply : score < 0 ? score + ply : 0;   // Exact, however deep the search
+    }
+    if(ply >= MAXPLY) {
+        return evaluate(game);
+    }
+    if(depth <= 0) {
+        --s->nodes; // quiesce() counts this node itself
+        return quiesce(alpha, beta, ply, s, game);
+    }
+    if(s->limits.table && probe(game->key, s->limits.table, &data)) {
+        ++s->hits;
+        score = (int)(data >> 16 & 0xFFFF) - INF;
+        if(score > WIN - MATES) {
+            score -= ply;
+        } else if(score < -WIN + MATES) {
+            score += ply;
+        }
+        if(ply && DEPTH(data) >= depth && ((data >> 8 & 0x3) == EXACT || ((data >> 8 & 0x3) == LOWER && score >= beta)
+                    || ((data >> 8 & 0x3) == UPPER && score <= alpha))) {
+            return score;   // Already know enough about this position
+        }
+        hash = unpackMove(data >> 32, game);
+    } else {
+        s->misses += s->limits.table != NULL;
+        hash.src = hash.dst = (Pos){0, 0};
+        hash.promo = EMPTY;
+    }
+    if(!generateAll(game, &picker.list)) {
+        return threatened(game->info.color, game->king[game->info.color], game) ? -WIN + ply : 0;
+    }
+    prepare(&picker, hash);
+    best = picker.list.move[0];
+    for(n = 0; pick(&picker, ply, s, &move); ++n) {
+        makeMove(move, game);
+        score = -negamax(depth - 1, -beta, -alpha, ply + 1, s, game);
+        unmakeMove(game);
+        if(*s->stop) {
+            return 0;
+        }
+        if(score > top) {
+            top = score;
+            best = move;
+            if(score > alpha) {
+                alpha = score;
+                bound = EXACT;
+                s->pv[ply][ply] = best; // Extend the principal variation with the child's line
+                for(s->length[ply] = ply + 1; s->length[ply] < s->length[ply + 1]; ++s->length[ply]) {
+                    s->pv[ply][s->length[ply]] = s->pv[ply + 1][s->length[ply]];
+                }
+                if(alpha >= beta) {
+                    bound = LOWER;
+                    ++s->cutoffs;
+                    s->firsts += !n;
+                    if(rate(move, ply, s) < CAPTURE) {
+                        reward(move, depth, ply, s);    // Quiet moves only; captures sort themselves
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    if(s->limits.table) {
+        s->collisions += store(game->key, pack(best, top, bound, depth, ply), s->limits.table);
+        ++s->stores;
+    }
+    return top;
+}
+
+static int quiesce(int alpha, int beta, int ply, Search *s, Game *game) { /* Search captures and promotions until the position is quiet {{{2 */
+    Picker picker;
+    Move move;
+    int score, top;
+    char check;
+    s->length[ply] = ply;
+    ++s->qnodes;
+    if(!(++s->nodes & 1023)) {
+        expired(s);
+    }
+    if(*s->stop) {
+        return 0;
+    }
+    if(game->noCap >= 100 || repetitions(game)) {
+        return 0;
+    }
+    if(ply >= MAXPLY) {
+        return evaluate(game);
+    }
+    check = threatened(game->info.color, game->king[game->info.color], game);
+    if(!generateAll(game, &picker.list)) {
+        return check ? -WIN + ply : 0;
+    }
+    if(check) {
+        top = -INF; // No standing pat in check: every evasion gets searched
+    } else if((top = evaluate(game)) >= beta) {
+        return top; // Standing pat is already good enough
+    }
+    if(top > alpha) {
+        alpha = top;
+    }
+    move.src = move.dst = (Pos){0, 0};
+    move.promo = EMPTY;
+    prepare(&picker, move);
+    while(pick(&picker, ply, s, &move)) {
+        if(!check && rate(move, ply, s) < CAPTURE) {
+            break;  // Captures and promotions come first; the rest are quiet
+        }
+        if(!check && (move.capture & 0x7) && see(move, game) < 0) {
+            continue;   // Loses material even after the exchanges
+        }
+        makeMove(move, game);
+        score = -quiesce(-beta, -alpha, ply + 1, s, game);
+        unmakeMove(game);
+        if(*s->stop) {
+            return 0;
+        }
+        if(score > top) {
+            top = score;
+            if(score > alpha) {
+                alpha = score;
+                if(alpha >= beta) {
+                    break;
+                }
+            }
+        }
+    }
+    return top;
+}
+
+static void *deepen(void *arg) { /* Iteratively deepen one thread until the search stops {{{2 */
+    Search *s = arg;
+    Result *result = &s->result;
+    int depth, score, n;
+    for(depth = 1 + (s->id & 1); depth <= (s->limits.depth ? s->limits.depth : MAXPLY); ++depth) {    // Odd helpers start a ply deeper, so threads spread over depths
+        score = negamax(depth, -INF, INF, 0, s, &s->game);
+        if(*s->stop) {
+            break;  // A partial iteration can't be trusted
+        }
+        result->depth = depth;
+        result->score = score;
+        if(s->length[0]) {  // A root cut short by a draw rule leaves no line, so keep the last one
+            result->length = s->length[0];
+            for(n = 0; n < s->length[0]; ++n) {
+                result->pv[n] = s->pv[0][n];
+            }
+            result->best = result->pv[0];
+        }
+        if(score > WIN - MATES || score < -WIN + MATES) {
+            break;  // Forced mate found; deeper won't change it
+        }
+    }
+    return NULL;
+}
+
+Result search(Game *game, Limits limits) { /* Iteratively deepen on limits.threads threads sharing limits.table {{{2 */
+    volatile char stop = 0;
+    Search *team;
+    pthread_t *helpers;
+    Result result;
+    Moves list;
+    int n;
+    result.depth = result.score = result.length = 0;
+    result.nodes = result.qnodes = result.cutoffs = result.firsts = 0;
+    result.hits = result.misses = result.stores = result.collisions = 0;  // Book moves and dead ends return before the totals
+    memset(&result.best, 0, sizeof(result.best));
+    if(generateAll(game, &list)) {
+        result.best = result.pv[0] = list.move[0];  // Something legal, even if the first iteration can't finish
+        result.length = 1;
+    }
+    if(limits.book && list.count && bookMove(limits.book, game, &result.best)) {
+        result.length = 1;  // Known opening move; nothing to search
+        result.pv[0] = result.best;
+        result.time = 0;
+        return result;
+    }
+    if(limits.threads < 1) {
+        limits.threads = 1;
+    }
+    team = malloc(limits.threads * sizeof(Search));
+    helpers = malloc(limits.threads * sizeof(pthread_t));
+    if(!team || !helpers || !list.count) {
+        free(team);
+        free(helpers);
+        result.time = 0;
+        return result;
+    }
+    for(n = 0; n < limits.threads; ++n) {
+        team[n].limits = limits;
+        team[n].start = seconds();
+        team[n].stop = &stop;
+        team[n].team = team;
+        team[n].id = n;
+        team[n].nodes = team[n].qnodes = team[n].cutoffs = team[n].firsts = 0;
+        team[n].hits = team[n].misses = team[n].stores = team[n].collisions = 0;
+        memset(team[n].killers, 0, sizeof(team[n].killers));
+        memset(team[n].history, 0, sizeof(team[n].history));
+        team[n].result = result;
+        copyGame(&team[n].game, game);
+    }
+    for(n = 1; n < limits.threads; ++n) {   // Helpers only fill the table for the main thread
+        if(pthread_create(&helpers[n], NULL, deepen, &team[n])) {
+            limits.threads = n;
+            break;
+        }
+    }
+    deepen(team);
+    stop = 1;
+    for(n = 1; n < limits.threads; ++n) {
+        pthread_join(helpers[n], NULL);
+    }
+    result = team[0].result;
+    result.nodes = result.qnodes = result.cutoffs = result.firsts = 0;
+    result.hits = result.misses = result.stores = result.collisions = 0;
+    for(n = 0; n < limits.threads; ++n) {
+        result.nodes += team[n].nodes;
+        result.qnodes += team[n].qnodes;
+        result.cutoffs += team[n].cutoffs;
+        result.firsts += team[n].firsts;
+        result.hits += team[n].hits;
+        result.misses += team[n].misses;
+        result.stores += team[n].stores;
+        result.collisions += team[n].collisions;
+    }
+    result.time = (seconds() - team[0].start) * 1000;
+    free(team);
+    free(helpers);
+    return result;
+}
@@ -1,10 +1,18 @@
 #include <ncurses.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "chess.h"
 
 #define COLOR(file,rank) (((file) + (rank)) % 2 ? 1 : 2)
 
+static Table table;
+static Book book;
+static Limits think = {0, 1000, 0, &table, 1, NULL};  // One second per engine move
+
 void printSpot(Pos spot, Game *game);
 void printBoard(Game *game);
+char play(Move move, Game *game);
 void user(Game *game);
 char getPromo();
 
@@ -21,7 +29,16 @@ int main(int argc, char **argv) {
     curs_set(0);
     noecho();
 
-    Game *game = newGame(getPromo);
+    if(!newTable(16, &table)) {
+        think.table = NULL; // Search without one rather than through an empty one
+    }
+    think.threads = sysconf(_SC_NPROCESSORS_ONLN);  // Every core helps the engine think
+    if(openBook(BOOK, &book)) {
+        think.book = &book; // Opening moves come straight from the book
+    }
+    openTablebases(TBDIR);  // Endgames with few pieces play perfectly when their tables are there
+    srand(time(NULL));  // So book games differ
+    Game *game = newGame();
     printBoard(game);
 
     user(game);
@@ -49,6 +66,7 @@ char getPromo() {
         case 'b':
             return BISHOP;
     }
+    return EMPTY;   // Anything else makes the move invalid
 }
 
 void printSpot(Pos spot, Game *game) {
@@ -81,23 +99,51 @@ void printBoard(Game *game) {
     mvprintw(8, 0, "%X %X", game->info.castle, game->info.color);
 }
 
-void displayMoves(Move *move) {
-    Move *iter;
-    char n;
-    if(move == NULL) {
-        return;
+void displayMoves(Moves *moves) {
+    int i;
+    for(i = 0; i < moves->count; ++i) {
+        mvchgat(7-moves->move[i].dst.rank, 3*moves->move[i].dst.file, 3, A_REVERSE, 3, NULL);
+    }
+}
+
+char play(Move move, Game *game) {
+    char ret = execMove(move, game);
+    if(ret > 0) {
+        printBoard(game);
     }
-    for(iter = move; iter->next; iter = iter->next) {
-        mvchgat(7-iter->dst.rank, 3*iter->dst.file, 3, A_REVERSE, 3, NULL);
+    switch(ret) {
+        case TURN:
+            mvprintw(9, 0, "It's not your turn.");
+            break;
+        case INVALID:
+            mvprintw(9, 0, "That piece can't move like that.");
+            break;
+        case THREAT:
+            mvprintw(9, 0, "That would leave your king in check.");
+            break;
+        case CHECK:
+            mvprintw(9, 0, "Check!");
+            break;
+        case STALE:
+            mvprintw(9, 0, "Stalemate!");
+            break;
+        case MATE:
+            mvprintw(9, 0, "Checkmate!");
+            break;
+        case TIE:
+            mvprintw(9, 0, "Draw!");
+            break;
     }
+    clrtoeol;
+    return ret;
 }
 
 void user(Game *game) {
     static char src = 1;
     static char ch;
-    static char ret;
-    static Move *valid;
+    static Moves valid;
     static Move move;
+    Result result;
     static Pos pos;
     static char cursX = 0;
     static char cursY = 0;
@@ -120,8 +166,8 @@ void user(Game *game) {
             case 'v':
                 printBoard(game);
                 pos = (Pos){cursX, 7-cursY};
-                valid = possible(pos, game);
-                displayMoves(valid);
+                possible(pos, game, &valid);
+                displayMoves(&valid);
                 break;
             case ' ':
                 if(src) {
@@ -131,34 +177,26 @@ void user(Game *game) {
                 } else {
                     move.dst = (Pos){cursX, 7-cursY};
                     move.capture = value(move.dst, game);
-                    ret = execMove(move, game);
-                    if(ret > 0) {
-                        printBoard(game);
-                    }
-                    switch(ret) {
-                        case TURN:
-                            mvprintw(9, 0, "It's not your turn.");
-                            break;
+                    move.promo = ((move.piece & 0x7) == PAWN && move.dst.rank == ((move.piece & 0x8) ? 0 : 7)) ? getPromo() : EMPTY;
+                    switch(play(move, game)) {
                         case INVALID:
-                            mvprintw(9, 0, "That piece can't move like that.");
-                            src = !src;
-                            break;
                         case THREAT:
-                            mvprintw(9, 0, "That would leave your king in check.");
-                            src = !src;
-                            break;
-                        case CHECK:
-                            mvprintw(9, 0, "Check!");
-                            break;
-                        case STALE:
-                            mvprintw(9, 0, "Stalemate!");
-                            break;
-                        case MATE:
-                            mvprintw(9, 0, "Checkmate!");
+                            src = !src; // Keep the source and pick another destination
                             break;
                     }
                     src = !src;
-                    clrtoeol;
+                }
+                break;
+            case 'c':
+                mvprintw(9, 0, "Thinking...");
+                clrtoeol();
+                refresh();
+                result = search(game, think);
+                if(result.length) {
+                    play(result.best, game);
+                } else {
+                    mvprintw(9, 0, "There's no move to make.");
+                    clrtoeol();
                 }
                 break;
         }
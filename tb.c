@@ -0,0 +1,554 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chess.h"
+
+#define CODES 1296      // Material signatures: 36 piece pairs for white times 36 for black
+#define ILLEGAL 0xFF    // Move count of an index that isn't a legal position
+#define NONE -32768     // No capture or promotion leaves the table from here
+#define CHUNK 65536     // Indices a builder thread takes at a time
+
+typedef struct _Man {   // A piece and its spot
+    char piece;
+    char sq;
+} Man;
+
+typedef struct _Base {  // One table, mapped from its file or still in memory from building it
+    char name[8];
+    char piece[TBMEN];    // Piece for each index digit: white king, black king, then white and black from strongest
+    char men;
+    char pawns;         // Pawns rule out mirroring ranks
+    int spots;          // Spots the white king is folded into: 16 without pawns, 32 with
+    unsigned long long size;
+    signed char *value;
+    void *map;
+    unsigned long long length;
+} Base;
+
+typedef enum _Phase {START, CONVERT, SPREAD} Phase;
+
+static Base *bases[CODES];  // By material signature
+static const char letters[] = " PNBRQ";
+static const char ranks[8] = {0, 1, 2, 0, 0, 3, 4, 5};  // Strength of each piece type, 0 for kings
+static const char promotions[] = {QUEEN, ROOK, BISHOP, KNIGHT};
+
+static struct {         // The table being built
+    Base *base;
+    unsigned char *count;   // Legal moves staying in the table not yet known to lose
+    short *conv;        // Best score among moves leaving the table, or NONE
+    Phase phase;
+    int level;          // Plies to mate being spread
+    volatile unsigned long long next;
+} build;
+
+static long long locate(Man *in, int n, char stm, Base **found);
+
+/* Scores {{{1 */
+/* Table bytes are 0 for a draw, v > 0 for a win by mate in v plies and v < 0 for mate against the side to
+ * move in -v - 1 plies. Building compares them as scores near +-1000, which order like search scores. */
+static int score(int v) { /* Comparable score for a table byte {{{2 */
+    return v > 0 ? 1000 - v : v < 0 ? -1001 - v : 0;
+}
+
+static signed char byte(int score) { /* Table byte for a score {{{2 */
+    return score > 0 ? 1000 - score : score < 0 ? -1001 - score : 0;
+}
+
+static int back(int score) { /* Score one ply before reaching a position with this score {{{2 */
+    return score > 0 ? 1 - score : score < 0 ? -1 - score : 0;
+}
+
+/* Signatures {{{1 */
+static void order(Man *men, int n, int *white, int *black) { /* Sort into index order and find each side's signature {{{2 */
+    Man man;
+    int k, j;
+    for(k = 1; k < n; ++k) {
+        man = men[k];
+        for(j = k; j && (ranks[men[j - 1].piece & 0x7] ? 1 : 0) * 16 + (men[j - 1].piece & BLACK) - ranks[men[j - 1].piece & 0x7]
+                > (ranks[man.piece & 0x7] ? 1 : 0) * 16 + (man.piece & BLACK) - ranks[man.piece & 0x7]; --j) {
+            men[j] = men[j - 1];
+        }
+        men[j] = man;
+    }
+    *white = *black = 0;
+    for(k = 2; k < n; ++k) {
+        if(men[k].piece & BLACK) {
+            *black = *black * 6 + ranks[men[k].piece & 0x7];
+        } else {
+            *white = *white * 6 + ranks[men[k].piece & 0x7];
+        }
+    }
+}
+
+static int parse(const char *name) { /* Signature for a table name like KQKR, or -1 {{{2 */
+    int color = -1, last = 6;
+    int sides[2] = {0, 0}, counts[2] = {0, 0};
+    const char *letter;
+    for(; *name; ++name) {
+        if(*name == 'K') {
+            if(++color > 1) {
+                return -1;
+            }
+            last = 6;
+        } else if(color < 0 || *name == ' ' || !(letter = strchr(letters, *name)) || letter - letters > last || ++counts[color] > 2) {
+            return -1;  // Each side's pieces come strongest first
+        } else {
+            sides[color] = sides[color] * 6 + (last = letter - letters);
+        }
+    }
+    if(color != 1 || sides[0] < sides[1] || counts[0] + counts[1] < 1 || counts[0] + counts[1] > TBMEN - 2) {
+        return -1;
+    }
+    return sides[0] * 36 + sides[1];
+}
+
+static Base *newBase(int code) { /* Describe the table for a signature {{{2 */
+    Base *base = calloc(1, sizeof(Base));
+    int sides[2] = {code / 36, code % 36};
+    int c, k, n = 2, length = 1;
+    if(!base) {
+        return NULL;
+    }
+    base->piece[0] = KING;
+    base->piece[1] = KING | BLACK;
+    base->name[0] = 'K';
+    for(c = 0; c < 2; ++c) {
+        if(c) {
+            base->name[length++] = 'K';
+        }
+        for(k = sides[c] >= 6 ? 6 : 1; k && sides[c]; k /= 6) {   // Signature digits, strongest first
+            base->piece[n++] = "\0\1\2\5\6\7"[sides[c] / k % 6] | c << 3;
+            base->name[length++] = letters[sides[c] / k % 6];
+            base->pawns |= sides[c] / k % 6 == 1;
+        }
+    }
+    base->name[length] = '\0';
+    base->men = n;
+    base->spots = base->pawns ? 32 : 16;
+    base->size = 2ULL * base->spots << 6 * (n - 1);
+    return base;
+}
+
+/* Indices {{{1 */
+static long long locate(Man *in, int n, char stm, Base **found) { /* Index of a position in its table, or -1 if no table has it {{{2 */
+    Man men[TBMEN];
+    Base *base;
+    long long index;
+    int white, black, k;
+    char flip = 0;
+    memcpy(men, in, n * sizeof(Man));
+    order(men, n, &white, &black);
+    if(black > white) { // Only the side with more is stored as white; swap colors and ranks
+        for(k = 0; k < n; ++k) {
+            men[k].piece ^= BLACK;
+            men[k].sq ^= 56;
+        }
+        stm = !stm;
+        order(men, n, &white, &black);
+    }
+    if(!(*found = base = bases[white * 36 + black])) {
+        return -1;
+    }
+    if((men[0].sq & 0x7) > 3) {
+        flip ^= 7;  // White king to the queen side
+    }
+    if(!base->pawns && (men[0].sq >> 3) > 3) {
+        flip ^= 56; // and the near half, if no pawns care which way is up
+    }
+    index = stm * base->spots + ((men[0].sq ^ flip) >> 3) * 4 + ((men[0].sq ^ flip) & 0x7);
+    for(k = 1; k < n; ++k) {
+        index = index << 6 | (men[k].sq ^ flip);
+    }
+    return index;
+}
+
+static char decode(Base *base, unsigned long long index, Man *men) { /* Pieces at an index. Returns the side to move {{{2 */
+    int k, spot;
+    for(k = base->men - 1; k; --k, index >>= 6) {
+        men[k].piece = base->piece[k];
+        men[k].sq = index & 0x3F;
+    }
+    spot = index % base->spots;
+    men[0].piece = KING;
+    men[0].sq = (spot >> 2) << 3 | (spot & 0x3);
+    return index / base->spots;
+}
+
+/* Positions {{{1 */
+static Bits occupied(Man *men, int n) { /* Spots holding a piece {{{2 */
+    Bits occ = 0;
+    int k;
+    for(k = 0; k < n; ++k) {
+        occ |= 1ULL << men[k].sq;
+    }
+    return occ;
+}
+
+static char attacked(Man *men, int n, char sq, char color, Bits occ) { /* Does a piece of color attack sq? {{{2 */
+    int k;
+    for(k = 0; k < n; ++k) {
+        if((men[k].piece & BLACK) == color << 3 && attacks(men[k].piece, men[k].sq, occ) >> sq & 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char legal(Man *men, int n, char stm) { /* Could this be reached in a game? {{{2 */
+    Bits occ = occupied(men, n);
+    int k;
+    if(__builtin_popcountll(occ) < n) {
+        return 0;
+    }
+    for(k = 2; k < n; ++k) {
+        if((men[k].piece & 0x7) == PAWN && ((men[k].sq >> 3) == 0 || (men[k].sq >> 3) == 7)) {
+            return 0;
+        }
+    }
+    return !attacked(men, n, men[!stm].sq, stm, occ);   // The side that just moved can't be in check
+}
+
+static Bits targets(Man *men, int n, int k, Bits occ, Bits own) { /* Spots men[k] can move to {{{2 */
+    char sq = men[k].sq, up = men[k].piece & BLACK ? -8 : 8;
+    Bits to;
+    if((men[k].piece & 0x7) != PAWN) {
+        return attacks(men[k].piece, sq, occ) & ~own;
+    }
+    to = attacks(men[k].piece, sq, occ) & occ & ~own;
+    if(!(occ >> (sq + up) & 1)) {
+        to |= 1ULL << (sq + up);
+        if((sq >> 3) == (up > 0 ? 1 : 6) && !(occ >> (sq + 2 * up) & 1)) {
+            to |= 1ULL << (sq + 2 * up);
+        }
+    }
+    return to;
+}
+
+static Bits sources(Man *men, int n, int k, Bits occ) { /* Empty spots men[k] could have come from without capturing {{{2 */
+    char sq = men[k].sq, rank = sq >> 3, black = men[k].piece & BLACK;
+    char down = black ? 8 : -8;
+    Bits from = 0;
+    if((men[k].piece & 0x7) != PAWN) {
+        return attacks(men[k].piece, sq, occ) & ~occ;
+    }
+    if((black ? rank <= 5 : rank >= 2) && !(occ >> (sq + down) & 1)) {
+        from |= 1ULL << (sq + down);
+        if(rank == (black ? 4 : 3) && !(occ >> (sq + 2 * down) & 1)) {
+            from |= 1ULL << (sq + 2 * down);    // A double step from home
+        }
+    }
+    return from;
+}
+
+/* Building {{{1 */
+static void start(unsigned long long index) { /* Score an index by its moves leaving the table and count the rest {{{2 */
+    Base *base = build.base, *other;
+    Man men[TBMEN], next[TBMEN];
+    Bits occ, own = 0, to;
+    char stm = decode(base, index, men), color = stm << 3;
+    int n = base->men, m, k, j, p, mover, moves = 0, inside = 0, best = NONE, s;
+    char promo;
+    long long at;
+    if(!legal(men, n, stm)) {
+        build.count[index] = ILLEGAL;
+        return;
+    }
+    occ = occupied(men, n);
+    for(k = 0; k < n; ++k) {
+        own |= (Bits)((men[k].piece & BLACK) == color) << men[k].sq;
+    }
+    for(k = 0; k < n; ++k) {
+        if((men[k].piece & BLACK) != color) {
+            continue;
+        }
+        for(to = targets(men, n, k, occ, own); to; to &= to - 1) {
+            memcpy(next, men, n * sizeof(Man));
+            next[mover = k].sq = LSB(to);
+            for(m = n, j = 2; j < n; ++j) {
+                if(j != k && men[j].sq == next[k].sq) {
+                    next[j] = next[--m];    // Captured
+                    mover = k == m ? j : k;
+                    break;
+                }
+            }
+            if(attacked(next, m, next[(int)stm].sq, !stm, occupied(next, m))) {
+                continue;
+            }
+            ++moves;
+            promo = (next[mover].piece & 0x7) == PAWN && (next[mover].sq >> 3) == (stm ? 0 : 7);
+            if(m == n && !promo) {
+                ++inside;
+                continue;
+            }
+            for(p = 0; p < (promo ? 4 : 1); ++p) {  // Captures and promotions land in smaller or pawnless tables
+                if(promo) {
+                    next[mover].piece = promotions[p] | color;
+                }
+                if(m == 2) {
+                    s = 0;  // Bare kings
+                } else {
+                    at = locate(next, m, !stm, &other);
+                    s = back(score(other->value[at]));
+                }
+                best = s > best ? s : best;
+            }
+        }
+    }
+    build.conv[index] = best;
+    if(!moves) {    // Mate or stalemate
+        base->value[index] = attacked(men, n, men[(int)stm].sq, !stm, occ) ? byte(-1000) : 0;
+        build.count[index] = 0;
+    } else {
+        if(!inside && best != NONE) {
+            base->value[index] = byte(best);
+        }
+        build.count[index] = inside;
+    }
+}
+
+static void convert(unsigned long long index) { /* Settle a win through a capture or promotion once its level comes up {{{2 */
+    if(build.count[index] != ILLEGAL && !build.base->value[index] && build.conv[index] == 1000 - build.level) {
+        build.base->value[index] = build.level;
+    }
+}
+
+static void spread(unsigned long long index) { /* Pass a result at this level back to the positions moving into it {{{2 */
+    Base *base = build.base, *other;
+    Man men[TBMEN], prev[TBMEN];
+    Bits occ, from;
+    char stm;
+    int n = base->men, k, s, level = build.level;
+    long long at;
+    if(base->value[index] != (level & 1 ? level : -level - 1)) {
+        return;
+    }
+    stm = decode(base, index, men);
+    occ = occupied(men, n);
+    for(k = 0; k < n; ++k) {
+        if((men[k].piece & BLACK) == stm << 3) {
+            continue;   // Only the side that just moved can be taken back
+        }
+        for(from = sources(men, n, k, occ); from; from &= from - 1) {
+            memcpy(prev, men, n * sizeof(Man));
+            prev[k].sq = LSB(from);
+            at = locate(prev, n, !stm, &other);
+            if(build.count[at] == ILLEGAL || base->value[at]) {
+                continue;
+            }
+            if(!(level & 1)) {
+                base->value[at] = level + 1;    // Moving here mates sooner than anything found later
+            } else if(!__sync_sub_and_fetch(build.count + at, 1)) {
+                s = -1000 + level + 1;  // Every move stays in the table and loses; this one holds out longest
+                if(build.conv[at] > s) {
+                    s = build.conv[at];
+                }
+                if(s < 0) {
+                    base->value[at] = byte(s);  // A win through a capture or promotion is settled by convert()
+                }
+            }
+        }
+    }
+}
+
+static void *work(void *arg) { /* Take chunks of indices for the current phase until they run out {{{2 */
+    unsigned long long index, end, size = build.base->size;
+    while((index = __sync_fetch_and_add(&build.next, CHUNK)) < size) {
+        for(end = index + CHUNK < size ? index + CHUNK : size; index < end; ++index) {
+            switch(build.phase) {
+                case START:
+                    start(index);
+                    break;
+                case CONVERT:
+                    convert(index);
+                    break;
+                case SPREAD:
+                    spread(index);
+                    break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void run(Phase phase, pthread_t *threads, int count) { /* Pass over every index on count threads {{{2 */
+    int n;
+    build.phase = phase;
+    build.next = 0;
+    for(n = 1; n < count; ++n) {
+        pthread_create(threads + n, NULL, work, NULL);
+    }
+    work(NULL);
+    for(n = 1; n < count; ++n) {
+        pthread_join(threads[n], NULL);
+    }
+}
+
+const char *buildTablebase(const char *dir, const char *name, int threads, TbStats *stats) { /* Build a table, write it to dir and use it. Returns NULL or why not {{{2 */
+    Man men[TBMEN], less[TBMEN];
+    Base *base, *other;
+    DbHeader header;
+    pthread_t *workers;
+    unsigned long long index;
+    char path[4096];
+    FILE *out;
+    int code = parse(name), k, p, v;
+    if(code < 0) {
+        return "not a table name";
+    }
+    if(bases[code]) {
+        return "already loaded";
+    }
+    if(!(base = newBase(code))) {
+        return "out of memory";
+    }
+    initBits();
+    for(k = 0; k < base->men; ++k) {
+        men[k].piece = base->piece[k];
+        men[k].sq = 0;
+    }
+    for(k = 2; k < base->men; ++k) {    // Everything a capture or promotion leads to must be built first
+        memcpy(less, men, sizeof(men));
+        less[k] = less[base->men - 1];
+        if(base->men > 3 && locate(less, base->men - 1, 0, &other) < 0) {
+            free(base);
+            return "needs the tables its captures lead to";
+        }
+        for(p = 0; (men[k].piece & 0x7) == PAWN && p < 4; ++p) {
+            memcpy(less, men, sizeof(men));
+            less[k].piece = promotions[p] | (men[k].piece & BLACK);
+            if(locate(less, base->men, 0, &other) < 0) {
+                free(base);
+                return "needs the tables its promotions lead to";
+            }
+        }
+    }
+    base->value = calloc(base->size, 1);
+    build.count = malloc(base->size);
+    build.conv = malloc(base->size * sizeof(short));
+    workers = malloc((threads > 0 ? threads : 1) * sizeof(pthread_t));
+    if(!base->value || !build.count || !build.conv || !workers) {
+        free(base->value);
+        free(build.count);
+        free(build.conv);
+        free(workers);
+        free(base);
+        return "out of memory";
+    }
+    build.base = bases[code] = base;    // Moves within the table look themselves up too
+    run(START, workers, threads);
+    for(build.level = 0; build.level < 127; ++build.level) {    // Results a ply further from mate each time
+        run(CONVERT, workers, threads);
+        run(SPREAD, workers, threads);
+    }
+    memset(stats, 0, sizeof(TbStats));
+    for(index = 0; index < base->size; ++index) {
+        if(build.count[index] == ILLEGAL) {
+            continue;
+        }
+        v = base->value[index];
+        if(v > 0) {
+            ++stats->wins;
+            stats->longest = v > stats->longest ? v : stats->longest;
+        } else if(v < 0) {
+            ++stats->losses;
+        } else {
+            ++stats->draws;
+        }
+    }
+    free(build.count);
+    free(build.conv);
+    free(workers);
+    snprintf(path, sizeof(path), "%s/%s.tb", dir, base->name);
+    if(!(out = fopen(path, "wb"))) {
+        return "can't write the table file";
+    }
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, TBMAGIC);
+    header.version = TBVERSION;
+    header.size = 1;
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(base->value, 1, base->size, out);
+    return fclose(out) ? "can't write the table file" : NULL;
+}
+
+/* Probing {{{1 */
+int openTablebases(const char *dir) { /* Map every table file in dir. Returns how many were new {{{2 */
+    const DbHeader *header;
+    struct dirent *entry;
+    struct stat st;
+    Base *base;
+    DIR *list = opendir(dir);
+    char name[8], path[4096];
+    int code, length, fd, count = 0;
+    if(!list) {
+        return 0;
+    }
+    while((entry = readdir(list))) {
+        length = strlen(entry->d_name);
+        if(length < 4 || length > 3 + sizeof(name) - 1 || strcmp(entry->d_name + length - 3, ".tb")) {
+            continue;
+        }
+        memcpy(name, entry->d_name, length - 3);
+        name[length - 3] = '\0';
+        if((code = parse(name)) < 0 || bases[code] || !(base = newBase(code))) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if((fd = open(path, O_RDONLY)) < 0) {
+            free(base);
+            continue;
+        }
+        if(fstat(fd, &st) || st.st_size != sizeof(DbHeader) + base->size
+                || (base->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            close(fd);
+            free(base);
+            continue;
+        }
+        close(fd);  // The mapping keeps the file open
+        base->length = st.st_size;
+        header = base->map;
+        if(memcmp(header->magic, TBMAGIC, sizeof(TBMAGIC)) || header->version != TBVERSION || header->size != 1) {
+            munmap(base->map, base->length);
+            free(base);
+            continue;
+        }
+        madvise(base->map, base->length, MADV_RANDOM);
+        base->value = (signed char *)(header + 1);
+        bases[code] = base;
+        ++count;
+    }
+    closedir(list);
+    return count;
+}
+
+char probeTablebase(Game *game, int *score) { /* Look up a position with TBMEN or fewer pieces. Returns 0 if no table has it {{{2 */
+    Bits all = game->occ[0] | game->occ[1], passant = game->bits[ENP] | game->bits[ENP | BLACK];
+    Man men[TBMEN];
+    Base *base;
+    long long index;
+    int n = 0, v;
+    if(__builtin_popcountll(all) > TBMEN || game->info.castle || (passant
+                && attacks(PAWN | !game->info.color << 3, LSB(passant), 0) & game->bits[PAWN | game->info.color << 3])) {
+        return 0;   // The tables know nothing of castling or en passant captures
+    }
+    for(; all; all &= all - 1, ++n) {
+        men[n].sq = LSB(all);
+        men[n].piece = value(POS(LSB(all)), game);
+    }
+    if(n == 2) {
+        *score = 0;
+        return 1;
+    }
+    if((index = locate(men, n, game->info.color, &base)) < 0) {
+        return 0;
+    }
+    v = base->value[index];
+    *score = v > 0 ? WIN - v : v < 0 ? -WIN - v - 1 : 0;
+    return 1;
+}
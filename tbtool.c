@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "chess.h"
+
+static const char *pieces = "QRBNP";   // Strongest first, as table names list them
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int strength(const char *side) { /* Signature value of one side's pieces, as the tables compare them */
+    int total = 0;
+    for(; *side; ++side) {
+        total = total * 6 + 5 - (strchr(pieces, *side) - pieces);
+    }
+    return total;
+}
+
+int names(char list[][8]) { /* Every table name in an order where each one's captures and promotions come earlier */
+    char sides[21][3];
+    int count = 0, n = 0, a, b, men, pawns;
+    sides[n++][0] = '\0';
+    for(a = 0; a < 5; ++a) {
+        sprintf(sides[n++], "%c", pieces[a]);
+    }
+    for(a = 0; a < 5; ++a) {
+        for(b = a; b < 5; ++b) {
+            sprintf(sides[n++], "%c%c", pieces[a], pieces[b]);
+        }
+    }
+    for(men = 3; men <= TBMEN; ++men) {
+        for(pawns = 0; pawns <= men - 2; ++pawns) {
+            for(a = 1; a < n; ++a) {
+                for(b = 0; b < n; ++b) {
+                    if(strlen(sides[a]) + strlen(sides[b]) == men - 2 && strength(sides[a]) >= strength(sides[b])
+                            && (strchr(sides[a], 'P') != NULL) + (strchr(sides[b], 'P') != NULL) + !strcmp(sides[a], "PP") == pawns) {
+                        sprintf(list[count++], "K%sK%s", sides[a], sides[b]);
+                    }
+                }
+            }
+        }
+    }
+    return count;
+}
+
+int generate(const char *dir, char **wanted, int count, int threads) { /* Build the wanted tables, or every missing one */
+    char list[64][8], path[4096];
+    const char *error;
+    TbStats stats;
+    double start;
+    int n, k, total = names(list);
+    for(k = 0; k < count; ++k) {
+        for(n = 0; n < total && strcmp(wanted[k], list[n]); ++n);
+        if(n == total) {
+            fprintf(stderr, "%s: not a table name\n", wanted[k]);
+            return 2;
+        }
+    }
+    mkdir(dir, 0777);
+    openTablebases(dir);
+    for(n = 0; n < total; ++n) {
+        for(k = 0; k < count && strcmp(wanted[k], list[n]); ++k);
+        snprintf(path, sizeof(path), "%s/%s.tb", dir, list[n]);
+        if((count && k == count) || (!count && !access(path, F_OK))) {
+            continue;
+        }
+        start = now();
+        if((error = buildTablebase(dir, list[n], threads, &stats))) {
+            fprintf(stderr, "%s: %s\n", list[n], error);
+            return 1;
+        }
+        printf("%s: %llu wins, %llu draws, %llu losses, longest mate %d plies, %.1fs\n",
+                list[n], stats.wins, stats.draws, stats.losses, stats.longest, now() - start);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+void describe(int score) { /* Print a table score in words */
+    if(score > WIN - MATES) {
+        printf("win, mate in %d plies", WIN - score);
+    } else if(score < -WIN + MATES) {
+        printf("loss, mated in %d plies", WIN + score);
+    } else {
+        printf("draw");
+    }
+}
+
+int lookup(const char *dir, const char *fen) { /* Print the table result for a position and each of its moves */
+    static char *reps = REPS;
+    Game *game = newGame();
+    Moves list;
+    int n, score;
+    if(!openTablebases(dir)) {
+        fprintf(stderr, "%s: no tables\n", dir);
+        free(game);
+        return 2;
+    }
+    if(!loadFen(fen, game)) {
+        fprintf(stderr, "Bad FEN: %s\n", fen);
+        free(game);
+        return 2;
+    }
+    if(!probeTablebase(game, &score)) {
+        printf("not in the tables\n");
+        free(game);
+        return 1;
+    }
+    describe(score);
+    printf("\n");
+    generateAll(game, &list);
+    for(n = 0; n < list.count; ++n) {
+        printf("%c%c%d%c%d%.1s ", reps[list.move[n].piece & 0x7], 'a' + list.move[n].src.file, list.move[n].src.rank + 1,
+                'a' + list.move[n].dst.file, list.move[n].dst.rank + 1, list.move[n].promo ? &reps[list.move[n].promo | 0x8] : "");
+        makeMove(list.move[n], game);
+        if(probeTablebase(game, &score)) {
+            describe(score > 0 ? 1 - score : score < 0 ? -1 - score : 0);  // A ply further from mate
+        } else {
+            printf("not in the tables");
+        }
+        printf("\n");
+        unmakeMove(game);
+    }
+    free(game);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *dir = TBDIR, *fen = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    char bad = 0;
+    while(!bad && (opt = getopt(argc, argv, "d:j:p:")) != -1) {
+        switch(opt) {
+            case 'd':   // Directory holding the tables
+                dir = optarg;
+                break;
+            case 'j':   // Threads building each table
+                threads = atoi(optarg);
+                break;
+            case 'p':   // Look up this position instead of building
+                fen = optarg;
+                break;
+            default:    // getopt() has already named the bad option
+                bad = 1;
+        }
+    }
+    if(bad || (fen && optind < argc)) {
+        fprintf(stderr, "usage: %s [-d dir] [-j threads] [KQKR...]\n       %s [-d dir] -p fen\n", argv[0], argv[0]);
+        return 2;
+    }
+    if(fen) {
+        return lookup(dir, fen);
+    }
+    return generate(dir, argv + optind, argc - optind, threads > 0 ? threads : 1);
+}
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chess.h"
+
+/* Table setup {{{1 */
+char newTable(unsigned int mb, Table *table) { /* Allocate the largest power of two buckets fitting in mb megabytes {{{2 */
+    unsigned long long buckets = 1;
+    void *mem;
+    while((buckets << 1) * BUCKET * sizeof(Entry) <= ((unsigned long long)mb << 20)) {
+        buckets <<= 1;
+    }
+    if(posix_memalign(&mem, 64, buckets * BUCKET * sizeof(Entry))) {  // Buckets line up with cache lines
+        return 0;
+    }
+    table->slot = mem;
+    table->mask = buckets - 1;
+    clearTable(table);
+    return 1;
+}
+
+void clearTable(Table *table) { /* Forget every entry {{{2 */
+    memset(table->slot, 0, (table->mask + 1) * BUCKET * sizeof(Entry));
+}
+
+void freeTable(Table *table) { /* Release the entries {{{2 */
+    free(table->slot);
+    table->slot = NULL;
+}
+
+/* Lookup and replacement {{{1 */
+char probe(unsigned long long key, Table *table, unsigned long long *data) { /* Find key, copying its data out. Returns 1 on a hit {{{2 */
+    Entry *bucket = table->slot + (key & table->mask) * BUCKET;
+    unsigned long long check;
+    char n;
+    for(n = 0; n < BUCKET; ++n) {
+        check = bucket[n].key;
+        *data = bucket[n].data;
+        if((check ^ *data) == key && *data) {   // A torn write from another thread won't pass this
+            return 1;
+        }
+    }
+    return 0;
+}
+
+char store(unsigned long long key, unsigned long long data, Table *table) { /* Save data for key; its low byte is the depth. Returns 1 if another position's entry made way {{{2 */
+    Entry *bucket = table->slot + (key & table->mask) * BUCKET;
+    Entry *slot = bucket;
+    char n, collided;
+    for(n = 0; n < BUCKET; ++n) {
+        if((bucket[n].key ^ bucket[n].data) == key || !bucket[n].data) {
+            slot = bucket + n;  // Refresh this position's own entry or fill an empty one
+            break;
+        }
+        if(n < BUCKET - 1 && DEPTH(bucket[n].data) < DEPTH(slot->data)) {
+            slot = bucket + n;  // Otherwise the shallowest of the depth-preferred entries
+        }
+    }
+    if(n == BUCKET && DEPTH(data) < DEPTH(slot->data)) {
+        slot = bucket + BUCKET - 1; // Too shallow to evict anything kept for depth, so use the always-replace entry
+    }
+    collided = slot->data && (slot->key ^ slot->data) != key;
+    slot->key = key ^ data; // Entries are checked by xor, so threads share the table without locks
+    slot->data = data;
+    return collided;
+}